@@ -1,22 +1,165 @@
 #pragma once
+#include <functional>
 #include "builder.hpp"
+#include "detour_kernel.hpp"
 
 namespace cpupg
 {
+    // 各阶段耗时（秒）和 LLC miss 数（-1 表示无法统计）
+    struct BuildStats
+    {
+        double reorder_time = 0;
+        double reverse_time = 0;
+        double merge_time = 0;
+        double repair_time = 0; // REPAIR_CONNECTIVITY 关闭时为 0
+        double entry_time = 0;  // ENTRY_POINTS 为 0 时为 0
+        int64_t reorder_misses = -1;
+        int64_t reverse_misses = -1;
+        int64_t merge_misses = -1;
+        int64_t repair_misses = -1;
+        int64_t entry_misses = -1;
+        double reorder_overlap = -1; // R_2HOP < R_INIT 时与精确 reorder 结果的重合率
+        // MAX_IN_DEGREE 生效时入度均衡前后的入度直方图，第 i 个桶为入度在 [2^(i-1), 2^i) 的节点数
+        std::vector<uint64_t> in_degree_before;
+        std::vector<uint64_t> in_degree_after;
+        uint32_t max_in_degree_before = 0;
+        uint32_t max_in_degree_after = 0;
+        uint64_t balanced_edges = 0; // 入度均衡时被替换的边数
+        uint64_t dropped_edges = 0;  // 入度均衡时找不到替代而去掉的边数
+        double peak_memory_mb = -1;  // 建图结束时进程的峰值常驻内存，-1 表示无法统计
+        // 连通性修复（多个输出时为最后一个图）：修复前后从入口点走不到的节点数、
+        // 补的边数（每条接回一个分量），以及与入口点强连通的节点数
+        uint64_t unreachable_before = 0;
+        uint64_t unreachable_after = 0;
+        uint64_t repaired_edges = 0;
+        uint64_t entry_scc_size = 0;
+        // 选出的入口点（多个输出时为最后一个图），以及此时其余节点到最近入口点的最大跳数
+        // 和走不到的节点数
+        std::vector<node_t> entry_points;
+        uint32_t entry_max_hops = 0;
+        uint64_t entry_unreachable = 0;
+
+        void print() const
+        {
+            printStage("Reorder", reorder_time, reorder_misses);
+            printStage("Reverse", reverse_time, reverse_misses);
+            printStage("Merge", merge_time, merge_misses);
+            if (entry_time > 0)
+            {
+                printStage("Entry", entry_time, entry_misses);
+                std::cout << "Entry points:";
+                for (node_t ep : entry_points)
+                {
+                    std::cout << " " << ep;
+                }
+                std::cout << ", farthest node " << entry_max_hops << " hops away, " << entry_unreachable
+                          << " unreachable" << std::endl;
+            }
+            if (repair_time > 0)
+            {
+                printStage("Repair", repair_time, repair_misses);
+                std::cout << "Connectivity repair: " << unreachable_before << " unreachable nodes, "
+                          << unreachable_before - unreachable_after << " repaired with " << repaired_edges << " new edges, "
+                          << unreachable_after << " still unreachable, " << entry_scc_size
+                          << " nodes strongly connected with the entry points" << std::endl;
+            }
+            if (reorder_overlap >= 0)
+            {
+                std::cout << "Reorder overlap with exact R_INIT^2 result: " << reorder_overlap << std::endl;
+            }
+            if (!in_degree_before.empty())
+            {
+                std::cout << "In-degree balancing replaced " << balanced_edges << " edges, dropped "
+                          << dropped_edges << std::endl;
+                printHistogram("In-degree before balancing", in_degree_before, max_in_degree_before);
+                printHistogram("In-degree after balancing", in_degree_after, max_in_degree_after);
+            }
+            if (peak_memory_mb >= 0)
+            {
+                std::cout << "Peak memory: " << peak_memory_mb << " MB" << std::endl;
+            }
+        }
+
+        static void printHistogram(const char *name, const std::vector<uint64_t> &hist, uint32_t max)
+        {
+            std::cout << name << ":";
+            for (size_t i = 0; i < hist.size(); i++)
+            {
+                if (hist[i] == 0)
+                {
+                    continue;
+                }
+                if (i == 0)
+                {
+                    std::cout << " [0]=" << hist[i];
+                }
+                else
+                {
+                    std::cout << " [" << (1ull << (i - 1)) << "," << (1ull << i) << ")=" << hist[i];
+                }
+            }
+            std::cout << ", max " << max << std::endl;
+        }
+
+        static void printStage(const char *stage, double time, int64_t misses)
+        {
+            std::cout << stage << " time: " << time << " s, cache misses: ";
+            if (misses < 0)
+            {
+                std::cout << "n/a" << std::endl;
+            }
+            else
+            {
+                std::cout << misses << std::endl;
+            }
+        }
+    };
+
     class CagraBuilder : public Builder
     {
     public:
         CagraBuilder(GraphInfo info);
         virtual ~CagraBuilder();
-        const Graph<> &build(Graph<> &knnG);
+        // 接管 knnG 的内存（reorder 后释放），结果图直接移交给调用方，不复制
+        Graph<> build(Graph<> &&knnG);
+        // 一次 reorder 扫描服务 rInits 中的每个 R_INIT 和 rs 中的每个 R（R 不大于任一 R_INIT），
+        // 按 R_INIT、R 升序依次 reverse、merge，每得到一个图调用一次 emit(R_INIT, R, graph)
+        void buildSweep(Graph<> &&knnG, std::vector<uint64_t> rInits, std::vector<uint64_t> rs,
+                        const std::function<void(uint64_t, uint64_t, const Graph<> &)> &emit);
+        const BuildStats &stats() const { return buildStats; }
 
     private:
+        void prepareReorder(const Graph<> &knnG);
         void reorder(Graph<> &knnG);
+        void scheduleNNCluster(const Graph<> &knnG);
+        node_t nodeAt(uint64_t i) const { return schedule.empty() ? i : schedule[i]; }
+        void reorderHashMap(Graph<> &knnG);
+        void reorderRankTable(Graph<> &knnG, SimdLevel level);
+        void reorderSortedMerge(Graph<> &knnG, SimdLevel level);
+        void reorderSweep(Graph<> &knnG, SimdLevel level, const std::vector<uint64_t> &rInits,
+                          std::vector<Graph<>> &outs);
+        double exactOverlap(const Graph<> &knnG);
+        void emitReordered(node_t id_x, const uint32_t *detours, const node_t *neighbors, uint64_t n,
+                           std::vector<uint32_t> &offsets);
         void reverse();
-        void merge();
+        // inPlace 表示之后不再用 reorderG：merge 尽量把结果写进它的内存，结束时释放它
+        void merge(bool inPlace);
+        template <uint64_t R_C>
+        void reverseFixed();
+        template <uint64_t R_C>
+        void mergeFixed(bool inPlace);
+        void balanceInDegree(uint64_t K);
+        void repairConnectivity();
+        void computeEntryPoints();
+        // 入度均衡要用到未进入最终行的反向边，此时仍单独保存 reversedG
+        bool fusedMerge() const { return info.FUSED_MERGE && info.MAX_IN_DEGREE == 0; }
 
         Graph<> reorderG;
         Graph<> reversedG;
         std::vector<uint64_t> edgeCount;
+        std::vector<uint8_t> reverseRanks; // 不融合且 MERGE_POLICY 为 interleave 时每条反向边的 rank
+        std::vector<uint8_t> reciprocal;   // 不融合且 MERGE_POLICY 为 reciprocal_first 时正向边是否互为邻居
+        std::vector<node_t> schedule;   // reorder 阶段的节点处理顺序，空表示按 id 顺序
+        BuildStats buildStats;
     };
 } // namespace cpupg
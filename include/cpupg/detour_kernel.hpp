@@ -0,0 +1,51 @@
+// Last Update: 2026-10-16
+// Description: Detour counting kernels for the reorder stage
+#pragma once
+
+#include <cstdint>
+#include "rank_table.hpp"
+
+namespace cpupg
+{
+  enum class SimdLevel
+  {
+    SCALAR,
+    AVX2,
+    AVX512,
+  };
+
+  const char *simdLevelName(SimdLevel level);
+
+  // 运行时检测 CPU 支持的最高指令集
+  SimdLevel detectSimdLevel();
+
+  // 对 y 的邻居 row[0, n)（y 在 x 邻居中的 rank 为 dist_x_y），
+  // 若 z 也是 x 的邻居且 max(dist_x_y, dist_y_z) < dist_x_z，则 detours[dist_x_z]++。
+  // 各指令集版本的结果完全一致。
+  void countDetours(const RankTable &neighbors_x, const uint32_t *row, uint64_t n,
+                    uint64_t dist_x_y, uint32_t *detours, SimdLevel level);
+
+  // 按距离判断绕路：dists_x[r] 为 x 到其 rank 为 r 的邻居的距离，row_dists 为 y 到 row 中各点的距离，
+  // 若 z 也是 x 的邻居且 max(d(x,y), d(y,z)) < d(x,z)，则 detours[dist_x_z]++
+  void countDetoursDist(const RankTable &neighbors_x, const float *dists_x,
+                        const uint32_t *row, const float *row_dists, uint64_t n,
+                        float dist_x_y, uint32_t *detours, SimdLevel level);
+
+  using DetourKernel = void (*)(const RankTable &neighbors_x, const uint32_t *row, uint64_t n,
+                                uint64_t dist_x_y, uint32_t *detours);
+  using DetourDistKernel = void (*)(const RankTable &neighbors_x, const float *dists_x,
+                                    const uint32_t *row, const float *row_dists, uint64_t n,
+                                    float dist_x_y, uint32_t *detours);
+
+  // 按指令集和行长 n 选出 kernel，供循环内反复调用。fixed 为真且 n 是常用度数
+  // （64、96、128、256）时返回行长为编译期常量、循环完全展开的版本，否则返回通用版本
+  DetourKernel selectDetourKernel(SimdLevel level, uint64_t n, bool fixed);
+  DetourDistKernel selectDetourDistKernel(SimdLevel level, uint64_t n, bool fixed);
+
+  // 有序归并版本：x 的邻居 (ids_x, ranks_x) 按 id 升序且 id 不重复，
+  // y 的邻居 (ids_y, ranks_y) 按 id 升序，允许重复。两者求交得到公共邻居 z，
+  // 只统计 dist_y_z < r_2hop 的 z，其余规则与 countDetours 相同。
+  void countDetoursMerge(const uint32_t *ids_x, const uint16_t *ranks_x, uint64_t n_x,
+                         const uint32_t *ids_y, const uint16_t *ranks_y, uint64_t n_y,
+                         uint64_t r_2hop, uint64_t dist_x_y, uint32_t *detours, SimdLevel level);
+} // namespace cpupg
@@ -3,10 +3,12 @@
 // Description: Graph data structure for nearest neighbor search
 #pragma once
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <memory>
+#include <utility>
 #include <vector>
 #include <iostream>
 #include <cassert>
@@ -14,12 +16,109 @@
 
 namespace cpupg
 {
+  // reorder 阶段 rank 查找所用的实现
+  enum class ReorderEngine
+  {
+    HASH_MAP,     // 每个节点新建 std::unordered_map
+    RANK_TABLE,   // 线程私有的开放寻址表，epoch 清空
+    SIMD,         // RANK_TABLE + 运行时选择的 AVX2/AVX-512 计数 kernel
+    SORTED_MERGE, // 邻居按 id 排序后做有序归并求交
+  };
+
+  inline const char *reorderEngineName(ReorderEngine engine)
+  {
+    switch (engine)
+    {
+    case ReorderEngine::HASH_MAP:
+      return "hash_map";
+    case ReorderEngine::RANK_TABLE:
+      return "rank_table";
+    case ReorderEngine::SIMD:
+      return "simd";
+    case ReorderEngine::SORTED_MERGE:
+      return "sorted_merge";
+    }
+    return "unknown";
+  }
+
+  // reorder 阶段处理节点的顺序
+  enum class ReorderSchedule
+  {
+    INDEX,      // 按节点 id 顺序
+    NN_CLUSTER, // 沿最近邻链找到同一簇的节点，连续处理
+  };
+
+  inline const char *reorderScheduleName(ReorderSchedule schedule)
+  {
+    switch (schedule)
+    {
+    case ReorderSchedule::INDEX:
+      return "index";
+    case ReorderSchedule::NN_CLUSTER:
+      return "nn_cluster";
+    }
+    return "unknown";
+  }
+
+  // reorder 阶段判断绕路的依据
+  enum class DetourMetric
+  {
+    RANK,     // max(rank(x,y), rank(y,z)) < rank(x,z)
+    DISTANCE, // max(d(x,y), d(y,z)) < d(x,z)，需要 KNNG 附带边距离
+  };
+
+  inline const char *detourMetricName(DetourMetric metric)
+  {
+    switch (metric)
+    {
+    case DetourMetric::RANK:
+      return "rank";
+    case DetourMetric::DISTANCE:
+      return "distance";
+    }
+    return "unknown";
+  }
+
+  // merge 阶段从正向边和反向边中挑选、排列一行的方式
+  enum class MergePolicy
+  {
+    FORWARD_FIRST,    // 先放正向边，再放反向边
+    INTERLEAVE,       // 正向边按在本行的 rank、反向边按在源节点行中的 rank 归并
+    RECIPROCAL_FIRST, // 正向边中互为邻居的优先，再放其余正向边和反向边
+  };
+
+  inline const char *mergePolicyName(MergePolicy policy)
+  {
+    switch (policy)
+    {
+    case MergePolicy::FORWARD_FIRST:
+      return "forward_first";
+    case MergePolicy::INTERLEAVE:
+      return "interleave";
+    case MergePolicy::RECIPROCAL_FIRST:
+      return "reciprocal_first";
+    }
+    return "unknown";
+  }
+
   struct GraphInfo
   {
     uint64_t N;
     uint64_t R;
     uint64_t R_INIT;
     uint64_t R_KNNG;
+    uint64_t R_2HOP = 0; // 两跳时每个 y 检查的邻居数，0 表示与 R_INIT 相同
+    ReorderEngine REORDER_ENGINE = ReorderEngine::SIMD;
+    ReorderSchedule REORDER_SCHEDULE = ReorderSchedule::INDEX;
+    DetourMetric DETOUR_METRIC = DetourMetric::RANK;
+    bool FIXED_DEGREE = true; // 常用度数使用编译期特化的 kernel
+    bool BUFFERED_SCATTER = true; // reverse 阶段按缓存大小分区，经线程私有缓冲区写出
+    uint64_t MAX_IN_DEGREE = 0;   // merge 后入度上限，超出的入边换给入度低的节点，0 表示不限制
+    bool FUSED_MERGE = true;      // reverse 时直接拼出最终的行，不保存 reversedG
+    MergePolicy MERGE_POLICY = MergePolicy::FORWARD_FIRST;
+    double REVERSE_RATIO = 0.5; // 每行反向边最多占的比例
+    bool REPAIR_CONNECTIVITY = false; // merge 后把从入口点走不到的节点接回图中
+    uint64_t ENTRY_POINTS = 0;        // merge 后选出的入口点个数，存入 Graph::eps，0 表示不选
 
     void print()
     {
@@ -27,17 +126,34 @@ namespace cpupg
       std::cout << "R: " << R << std::endl;
       std::cout << "R_INIT: " << R_INIT << std::endl;
       std::cout << "R_KNNG: " << R_KNNG << std::endl;
+      std::cout << "R_2HOP: " << R_2HOP << std::endl;
+      std::cout << "REORDER_ENGINE: " << reorderEngineName(REORDER_ENGINE) << std::endl;
+      std::cout << "REORDER_SCHEDULE: " << reorderScheduleName(REORDER_SCHEDULE) << std::endl;
+      std::cout << "DETOUR_METRIC: " << detourMetricName(DETOUR_METRIC) << std::endl;
+      std::cout << "FIXED_DEGREE: " << (FIXED_DEGREE ? "true" : "false") << std::endl;
+      std::cout << "BUFFERED_SCATTER: " << (BUFFERED_SCATTER ? "true" : "false") << std::endl;
+      std::cout << "MAX_IN_DEGREE: " << MAX_IN_DEGREE << std::endl;
+      std::cout << "FUSED_MERGE: " << (FUSED_MERGE ? "true" : "false") << std::endl;
+      std::cout << "MERGE_POLICY: " << mergePolicyName(MERGE_POLICY) << std::endl;
+      std::cout << "REVERSE_RATIO: " << REVERSE_RATIO << std::endl;
+      std::cout << "REPAIR_CONNECTIVITY: " << (REPAIR_CONNECTIVITY ? "true" : "false") << std::endl;
+      std::cout << "ENTRY_POINTS: " << ENTRY_POINTS << std::endl;
     }
   };
 
-  constexpr int EMPTY_ID = -1;
-  template <typename id_t = int32_t>
+  // 节点 id 为无符号 32 位，最多 2^32 - 1 个节点，全 1（即 -1）留作空位。
+  // 节点数、边数和 i * K + j 这样的下标都按 64 位计算
+  using node_t = uint32_t;
+  constexpr node_t EMPTY_ID = UINT32_MAX;
+
+  template <typename id_t = node_t>
   struct Graph
   {
-    id_t N;
+    uint64_t N;
     uint64_t K;
 
     id_t *data = nullptr;
+    float *dists = nullptr; // 可选，与 data 一一对应的边距离
 
     std::vector<id_t> eps;
 
@@ -51,24 +167,47 @@ namespace cpupg
 
     // Graph(id_t *edges, int N, int K) : N(N), K(K), data(edges) {}
 
-    Graph(id_t N, uint64_t K)
+    Graph(uint64_t N, uint64_t K)
     {
       init(N, K);
     }
 
-    Graph(const Graph &g) : Graph(g.N, g.K)
+    // 整图复制开销与图同样大，只允许显式调用，如 Graph<> copy(g)；传递结果用移动
+    explicit Graph(const Graph &g)
     {
+      allocate(g.N, g.K);
       this->eps = g.eps;
-      for (id_t i = 0; i < N; ++i)
+      memcpy(data, g.data, (size_t)N * K * sizeof(id_t));
+      if (g.dists != nullptr)
       {
-        for (uint64_t j = 0; j < K; ++j)
-        {
-          at(i, j) = g.at(i, j);
-        }
+        initDists();
+        memcpy(dists, g.dists, (size_t)N * K * sizeof(float));
+      }
+    }
+
+    // 移动只转交内存，g 变为空图
+    Graph(Graph &&g) noexcept : N(g.N), K(g.K), data(g.data), dists(g.dists), eps(std::move(g.eps))
+    {
+      g.N = 0;
+      g.K = 0;
+      g.data = nullptr;
+      g.dists = nullptr;
+      g.eps.clear();
+    }
+
+    Graph &operator=(Graph &&g) noexcept
+    {
+      if (this != &g)
+      {
+        destory();
+        swap(g);
       }
+      return *this;
     }
 
-    void init(id_t N, uint64_t K)
+    Graph &operator=(const Graph &) = delete;
+
+    void init(uint64_t N, uint64_t K)
     {
       assert(N > 0);
       assert(K > 0);
@@ -78,6 +217,37 @@ namespace cpupg
       // graph_po = K / 16;
     }
 
+    // 与 init 相同但不把内容填为 -1，调用方需写满每一行
+    void allocate(uint64_t N, uint64_t K)
+    {
+      assert(N > 0);
+      assert(K > 0);
+      alloc2MNoFill((void **)&data, N * K * sizeof(id_t));
+      this->K = K;
+      this->N = N;
+    }
+
+    // 每行改为前 K 个（不大于原来的 K），调用方已把数据按新的行长排好。
+    // 不再使用的尾部交还给系统，不重新分配
+    void shrinkDegree(uint64_t K)
+    {
+      assert(K <= this->K && dists == nullptr);
+      size_t used = ((size_t)N * K * sizeof(id_t) + 4095) & ~(size_t)4095;
+      size_t total = (size_t)N * this->K * sizeof(id_t);
+      if (used < total)
+      {
+        madvise((char *)data + used, total - used, MADV_DONTNEED);
+      }
+      this->K = K;
+    }
+
+    void initDists()
+    {
+      assert(data != nullptr);
+      alloc2M((void **)&dists, (size_t)N * K * sizeof(float), 0);
+    }
+
+    // 释放内存并变为空图（N = K = 0），之后不能再按旧的大小访问
     void destory()
     {
       if (data != nullptr)
@@ -85,6 +255,14 @@ namespace cpupg
         free(data);
         data = nullptr;
       }
+      if (dists != nullptr)
+      {
+        free(dists);
+        dists = nullptr;
+      }
+      eps.clear();
+      N = 0;
+      K = 0;
     }
 
     ~Graph()
@@ -92,33 +270,49 @@ namespace cpupg
       destory();
     }
 
-    const id_t *edges(id_t u) const { return data + K * u; }
+    // 交换两个图的全部内容，不复制数据
+    void swap(Graph &g)
+    {
+      std::swap(N, g.N);
+      std::swap(K, g.K);
+      std::swap(data, g.data);
+      std::swap(dists, g.dists);
+      eps.swap(g.eps);
+    }
+
+    const id_t *edges(uint64_t u) const { return data + K * u; }
+
+    id_t *edges(uint64_t u) { return data + K * u; }
+
+    id_t at(uint64_t i, uint64_t j) const { return data[i * K + j]; }
 
-    id_t *edges(id_t u) { return data + K * u; }
+    id_t &at(uint64_t i, uint64_t j) { return data[i * K + j]; }
 
-    id_t at(id_t i, uint64_t j) const { return data[i * K + j]; }
+    const float *edgeDists(uint64_t u) const { return dists + K * u; }
 
-    id_t &at(id_t i, uint64_t j) { return data[i * K + j]; }
+    float dist(uint64_t i, uint64_t j) const { return dists[i * K + j]; }
 
-    void prefetch(id_t u, int lines) const
+    void prefetch(uint64_t u, int lines) const
     {
       mem_prefetch((char *)edges(u), lines);
     }
 
     void save(const std::string &filename) const
     {
-      static_assert(std::is_same_v<id_t, int32_t>);
+      static_assert(sizeof(id_t) == 4);
       std::ofstream writer(filename.c_str(), std::ios::binary);
       int nep = eps.size();
+      unsigned num = N;
+      unsigned k = K;
       writer.write((char *)&nep, 4);
       writer.write((char *)eps.data(), nep * 4);
-      writer.write((char *)&N, 4);
-      writer.write((char *)&K, 4);
+      writer.write((char *)&num, 4);
+      writer.write((char *)&k, 4);
       writer.write((char *)data, N * K * 4);
       printf("Graph Saving done\n");
     }
 
-    void loadNsg(const char *filename, id_t baseN)
+    void loadNsg(const char *filename, uint64_t baseN)
     {
       std::ifstream in(filename, std::ios::binary);
       if (!in.is_open())
@@ -129,10 +323,10 @@ namespace cpupg
       unsigned width, ep_;
       in.read((char *)&width, 4);
       in.read((char *)&ep_, 4);
-      eps.resize(1);
-      eps[0] = ep_;
       destory();
       init(baseN, width);
+      eps.resize(1);
+      eps[0] = ep_;
       size_t nd = 0;
       size_t cc = 0;
       while (!in.eof())
@@ -203,6 +397,7 @@ namespace cpupg
 
     void loadKnngFbin(const char *filename)
     {
+      static_assert(sizeof(id_t) == 4);
       // fbin format
       // num(usigned 4B),k(unsigned 4B),vector(unsigned 4B * num * k)
       std::ifstream in(filename, std::ios::binary);
@@ -221,7 +416,34 @@ namespace cpupg
       in.close();
     }
 
-    void saveKnng(const char *filename)
+    void loadDistsFbin(const char *filename)
+    {
+      // 边距离文件，与 fbin 相同的布局
+      // num(usigned 4B),k(unsigned 4B),distance(float 4B * num * k)
+      // 第 i 行第 j 个距离对应 at(i, j)，须在加载 KNNG 之后调用
+      std::ifstream in(filename, std::ios::binary);
+      if (!in.is_open())
+      {
+        std::cerr << "Error: Cannot open file " << filename << std::endl;
+        exit(1);
+      }
+      unsigned num, k;
+      in.read(reinterpret_cast<char *>(&num), sizeof(unsigned));
+      in.read(reinterpret_cast<char *>(&k), sizeof(unsigned));
+      if (num != N || k != K)
+      {
+        std::cerr << "Error: Distance file shape " << num << "x" << k << " does not match graph " << N << "x" << K << std::endl;
+        exit(1);
+      }
+      if (dists == nullptr)
+      {
+        initDists();
+      }
+      in.read(reinterpret_cast<char *>(dists), (size_t)num * (size_t)k * sizeof(float));
+      in.close();
+    }
+
+    void saveKnng(const char *filename) const
     {
       // knng format
       // k(usigned 4B),vector(unsigned 4B * k),k,vector...
@@ -235,9 +457,9 @@ namespace cpupg
 
       unsigned k = K;
 
-      for (id_t i = 0; i < N; i++)
+      for (uint64_t i = 0; i < N; i++)
       {
-        id_t *edge = edges(i);
+        const id_t *edge = edges(i);
         out.write(reinterpret_cast<const char *>(&k), sizeof(unsigned));
         out.write(reinterpret_cast<const char *>(edge), k * sizeof(id_t));
       }
@@ -245,24 +467,24 @@ namespace cpupg
       out.close();
     }
 
-    void saveNsg(const char *filename)
+    void saveNsg(const char *filename) const
     {
       std::ofstream out(filename, std::ios::binary | std::ios::out);
       
       unsigned width = K;
-      unsigned ep = 0;
+      unsigned ep = eps.empty() ? 0 : eps[0]; // NSG 格式只能存一个入口点
       out.write((char *)&width, sizeof(unsigned));
       out.write((char *)&ep, sizeof(unsigned));
-      for (id_t i = 0; i < N; i++)
+      for (uint64_t i = 0; i < N; i++)
       {
-        id_t *edge = edges(i);
+        const id_t *edge = edges(i);
         out.write((char *)&width, sizeof(unsigned));
         out.write(reinterpret_cast<const char *>(edge), width * sizeof(id_t));
       }
       out.close();
     }
 
-    void debug(id_t i)
+    void debug(uint64_t i)
     {
       for (uint64_t j = 0; j < K; j++)
       {
@@ -272,4 +494,96 @@ namespace cpupg
     }
   };
 
+  // 变长度的 CSR 图：第 u 个节点的邻居为 ids[offsets[u], offsets[u + 1])，不含 -1 空位
+  struct CsrGraph
+  {
+    uint64_t N = 0;
+    std::vector<uint64_t> offsets;
+    std::vector<node_t> ids;
+    std::vector<node_t> eps;
+
+    CsrGraph() {}
+
+    // 从定长图转换，去掉每行中的 -1，保持其余邻居的顺序
+    explicit CsrGraph(const Graph<> &g) : N(g.N), offsets(g.N + 1, 0), eps(g.eps)
+    {
+#pragma omp parallel for
+      for (uint64_t i = 0; i < N; i++)
+      {
+        offsets[i + 1] = g.K - std::count(g.edges(i), g.edges(i) + g.K, EMPTY_ID);
+      }
+      for (uint64_t i = 0; i < N; i++)
+      {
+        offsets[i + 1] += offsets[i];
+      }
+      ids.resize(offsets[N]);
+#pragma omp parallel for
+      for (uint64_t i = 0; i < N; i++)
+      {
+        std::copy_if(g.edges(i), g.edges(i) + g.K, &ids[offsets[i]], [](node_t id)
+                     { return id != EMPTY_ID; });
+      }
+    }
+
+    uint64_t degree(uint64_t u) const { return offsets[u + 1] - offsets[u]; }
+
+    const node_t *edges(uint64_t u) const { return ids.data() + offsets[u]; }
+
+    // csr 格式
+    // num(unsigned 4B),nep(unsigned 4B),eps(unsigned 4B * nep),degree(unsigned 4B * num),ids(unsigned 4B * 总边数)
+    void save(const char *filename) const
+    {
+      std::ofstream out(filename, std::ios::binary);
+      if (!out.is_open())
+      {
+        std::cerr << "Error: Cannot open file " << filename << std::endl;
+        exit(1);
+      }
+      unsigned num = N;
+      unsigned nep = eps.size();
+      out.write((char *)&num, sizeof(unsigned));
+      out.write((char *)&nep, sizeof(unsigned));
+      out.write((char *)eps.data(), nep * sizeof(node_t));
+      std::vector<unsigned> degrees(N);
+      for (uint64_t i = 0; i < N; i++)
+      {
+        degrees[i] = degree(i);
+      }
+      out.write((char *)degrees.data(), (size_t)N * sizeof(unsigned));
+      out.write((char *)ids.data(), ids.size() * sizeof(node_t));
+      out.close();
+    }
+
+    void load(const char *filename)
+    {
+      std::ifstream in(filename, std::ios::binary);
+      if (!in.is_open())
+      {
+        std::cerr << "Error: Cannot open file " << filename << std::endl;
+        exit(1);
+      }
+      unsigned num, nep;
+      in.read((char *)&num, sizeof(unsigned));
+      in.read((char *)&nep, sizeof(unsigned));
+      N = num;
+      eps.resize(nep);
+      in.read((char *)eps.data(), nep * sizeof(node_t));
+      std::vector<unsigned> degrees(N);
+      in.read((char *)degrees.data(), (size_t)N * sizeof(unsigned));
+      offsets.assign(N + 1, 0);
+      for (uint64_t i = 0; i < N; i++)
+      {
+        offsets[i + 1] = offsets[i] + degrees[i];
+      }
+      ids.resize(offsets[N]);
+      in.read((char *)ids.data(), ids.size() * sizeof(node_t));
+      if (!in)
+      {
+        std::cerr << "Error: " << filename << " is truncated" << std::endl;
+        exit(1);
+      }
+      in.close();
+    }
+  };
+
 } // namespace npuanns
\ No newline at end of file
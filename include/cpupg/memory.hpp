@@ -7,6 +7,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstddef>
+#include <iostream>
 #include <sys/mman.h>
 #include <stdexcept>
 #include <sys/resource.h>
@@ -42,12 +43,23 @@
 
 #endif
 
-inline void printMemoryUsage()
+// 进程的峰值常驻内存（MB），获取失败时返回 -1
+inline double peakMemoryMB()
 {
     struct rusage usage;
     if (getrusage(RUSAGE_SELF, &usage) == 0)
     {
-        std::cout << "Memory usage: " << usage.ru_maxrss / 1024.0 << " MB" << std::endl;
+        return usage.ru_maxrss / 1024.0;
+    }
+    return -1;
+}
+
+inline void printMemoryUsage()
+{
+    double peak = peakMemoryMB();
+    if (peak >= 0)
+    {
+        std::cout << "Memory usage: " << peak << " MB" << std::endl;
     }
     else
     {
@@ -65,7 +77,8 @@ inline void alloc64B(void **hostPtr, size_t nbytes, int value)
     memset(*hostPtr, value, len);
 }
 
-inline void alloc2M(void **hostPtr, size_t nbytes, int value)
+// 只分配不初始化，物理页在第一次写入时才分配，可以由写入各行的线程并行完成
+inline size_t alloc2MNoFill(void **hostPtr, size_t nbytes)
 {
     size_t len = (nbytes + (1 << 21) - 1) >> 21 << 21;
     if (posix_memalign(hostPtr, 1 << 21, len) != 0)
@@ -73,6 +86,12 @@ inline void alloc2M(void **hostPtr, size_t nbytes, int value)
         throw std::bad_alloc(); // 分配失败时抛出异常
     }
     madvise(*hostPtr, len, MADV_HUGEPAGE); // 使用大页内存
+    return len;
+}
+
+inline void alloc2M(void **hostPtr, size_t nbytes, int value)
+{
+    size_t len = alloc2MNoFill(hostPtr, nbytes);
     memset(*hostPtr, value, len);
 }
 
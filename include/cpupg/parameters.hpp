@@ -3,8 +3,10 @@
 #include <iostream>
 #include <string>
 #include <typeinfo>
+#include <vector>
 #include "../rapidjson/document.h"
 #include "../rapidjson/filereadstream.h"
+#include "graph.hpp"
 
 namespace cpupg
 {
@@ -13,11 +15,112 @@ namespace cpupg
     {
         std::string knng_path;
         std::string knng_format;
+        std::string knng_dist_path;
         std::string save_path;
-        uint64_t r_init;
-        uint64_t r;
+        uint64_t r_init = 0;
+        std::vector<uint64_t> r_init_sweep; // 非空时一次 reorder 输出其中每个 R_INIT 的图
+        uint64_t r = 0;
+        std::vector<uint64_t> r_sweep; // 非空时共用 reorder 结果输出其中每个 R 的图
+        uint64_t r_2hop = 0;
+        ReorderEngine reorder_engine = ReorderEngine::SIMD;
+        ReorderSchedule reorder_schedule = ReorderSchedule::INDEX;
+        DetourMetric detour_metric = DetourMetric::RANK;
+        bool fixed_degree = true;
+        bool buffered_scatter = true;
+        uint64_t max_in_degree = 0;
+        bool fused_merge = true;
+        MergePolicy merge_policy = MergePolicy::FORWARD_FIRST;
+        double reverse_ratio = 0.5;
+        bool repair_connectivity = false;
+        uint64_t entry_points = 0;
+        std::string base_path;  // 原始向量（fbin），只有 bench_merge 使用
+        std::string query_path; // 查询向量（fbin），只有 bench_merge 使用
     };
 
+    // 将字符串解析为 ReorderEngine
+    ReorderEngine parseReorderEngine(const std::string &name)
+    {
+        for (ReorderEngine engine : {ReorderEngine::HASH_MAP, ReorderEngine::RANK_TABLE,
+                                     ReorderEngine::SIMD, ReorderEngine::SORTED_MERGE})
+        {
+            if (name == reorderEngineName(engine))
+            {
+                return engine;
+            }
+        }
+        std::cerr << "Error: Unknown REORDER_ENGINE " << name << std::endl;
+        exit(1);
+    }
+
+    // 将字符串解析为 ReorderSchedule
+    ReorderSchedule parseReorderSchedule(const std::string &name)
+    {
+        for (ReorderSchedule schedule : {ReorderSchedule::INDEX, ReorderSchedule::NN_CLUSTER})
+        {
+            if (name == reorderScheduleName(schedule))
+            {
+                return schedule;
+            }
+        }
+        std::cerr << "Error: Unknown REORDER_SCHEDULE " << name << std::endl;
+        exit(1);
+    }
+
+    // 将字符串解析为 DetourMetric
+    DetourMetric parseDetourMetric(const std::string &name)
+    {
+        for (DetourMetric metric : {DetourMetric::RANK, DetourMetric::DISTANCE})
+        {
+            if (name == detourMetricName(metric))
+            {
+                return metric;
+            }
+        }
+        std::cerr << "Error: Unknown DETOUR_METRIC " << name << std::endl;
+        exit(1);
+    }
+
+    // 将字符串解析为 MergePolicy
+    MergePolicy parseMergePolicy(const std::string &name)
+    {
+        for (MergePolicy policy : {MergePolicy::FORWARD_FIRST, MergePolicy::INTERLEAVE, MergePolicy::RECIPROCAL_FIRST})
+        {
+            if (name == mergePolicyName(policy))
+            {
+                return policy;
+            }
+        }
+        std::cerr << "Error: Unknown MERGE_POLICY " << name << std::endl;
+        exit(1);
+    }
+
+    // 配置的 R_INIT 列表，没有 R_INIT_SWEEP 时只有 R_INIT
+    std::vector<uint64_t> rInitValues(const CagraConfig &config)
+    {
+        return config.r_init_sweep.empty() ? std::vector<uint64_t>{config.r_init} : config.r_init_sweep;
+    }
+
+    // 配置的 R 列表，没有 R_SWEEP 时只有 R
+    std::vector<uint64_t> rValues(const CagraConfig &config)
+    {
+        return config.r_sweep.empty() ? std::vector<uint64_t>{config.r} : config.r_sweep;
+    }
+
+    // 多输出时 (R_INIT, R) 对应的保存路径，只为给了列表的参数加后缀
+    std::string sweepSavePath(const CagraConfig &config, uint64_t r_init, uint64_t r)
+    {
+        std::string path = config.save_path;
+        if (!config.r_init_sweep.empty())
+        {
+            path += ".r_init" + std::to_string(r_init);
+        }
+        if (!config.r_sweep.empty())
+        {
+            path += ".r" + std::to_string(r);
+        }
+        return path;
+    }
+
     // 从 JSON 文件加载配置
     CagraConfig loadCagraConfig(const char *filename)
     {
@@ -68,6 +171,12 @@ namespace cpupg
             std::cerr << "Error: KNNG_FORMAT not found or not a string." << std::endl;
         }
 
+        // 读取 KNNG_DIST_PATH（可选）
+        if (cagra.HasMember("KNNG_DIST_PATH") && cagra["KNNG_DIST_PATH"].IsString())
+        {
+            config.knng_dist_path = cagra["KNNG_DIST_PATH"].GetString();
+        }
+
         // 读取 SAVE_PATH
         if (cagra.HasMember("SAVE_PATH") && cagra["SAVE_PATH"].IsString())
         {
@@ -78,26 +187,191 @@ namespace cpupg
             std::cerr << "Error: SAVE_PATH not found or not a string." << std::endl;
         }
 
-        // 读取 R_INIT
+        // 读取 R_INIT_SWEEP（可选）
+        if (cagra.HasMember("R_INIT_SWEEP") && cagra["R_INIT_SWEEP"].IsArray())
+        {
+            for (const rapidjson::Value &r_init : cagra["R_INIT_SWEEP"].GetArray())
+            {
+                if (!r_init.IsUint64())
+                {
+                    std::cerr << "Error: R_INIT_SWEEP must be an array of Uint64." << std::endl;
+                    exit(1);
+                }
+                config.r_init_sweep.push_back(r_init.GetUint64());
+            }
+        }
+
+        // 读取 R_INIT，给出 R_INIT_SWEEP 时可省略
         if (cagra.HasMember("R_INIT") && cagra["R_INIT"].IsUint64())
         {
             config.r_init = cagra["R_INIT"].GetUint64();
         }
-        else
+        else if (config.r_init_sweep.empty())
         {
             std::cerr << "Error: R_INIT not found or not an Uint64." << std::endl;
         }
 
-        // 读取 R
+        // 读取 R_SWEEP（可选）
+        if (cagra.HasMember("R_SWEEP") && cagra["R_SWEEP"].IsArray())
+        {
+            for (const rapidjson::Value &r : cagra["R_SWEEP"].GetArray())
+            {
+                if (!r.IsUint64())
+                {
+                    std::cerr << "Error: R_SWEEP must be an array of Uint64." << std::endl;
+                    exit(1);
+                }
+                config.r_sweep.push_back(r.GetUint64());
+            }
+        }
+
+        // 读取 R，给出 R_SWEEP 时可省略
         if (cagra.HasMember("R") && cagra["R"].IsUint64())
         {
             config.r = cagra["R"].GetUint64();
         }
-        else
+        else if (config.r_sweep.empty())
         {
             std::cerr << "Error: R not found or not an Uint64." << std::endl;
         }
 
+        // 读取 R_2HOP（可选）
+        if (cagra.HasMember("R_2HOP") && cagra["R_2HOP"].IsUint64())
+        {
+            config.r_2hop = cagra["R_2HOP"].GetUint64();
+        }
+
+        // 读取 REORDER_ENGINE（可选）
+        if (cagra.HasMember("REORDER_ENGINE") && cagra["REORDER_ENGINE"].IsString())
+        {
+            config.reorder_engine = parseReorderEngine(cagra["REORDER_ENGINE"].GetString());
+        }
+
+        // 读取 REORDER_SCHEDULE（可选）
+        if (cagra.HasMember("REORDER_SCHEDULE") && cagra["REORDER_SCHEDULE"].IsString())
+        {
+            config.reorder_schedule = parseReorderSchedule(cagra["REORDER_SCHEDULE"].GetString());
+        }
+
+        // 读取 DETOUR_METRIC（可选）
+        if (cagra.HasMember("DETOUR_METRIC") && cagra["DETOUR_METRIC"].IsString())
+        {
+            config.detour_metric = parseDetourMetric(cagra["DETOUR_METRIC"].GetString());
+        }
+
+        // 读取 FIXED_DEGREE（可选）
+        if (cagra.HasMember("FIXED_DEGREE") && cagra["FIXED_DEGREE"].IsBool())
+        {
+            config.fixed_degree = cagra["FIXED_DEGREE"].GetBool();
+        }
+
+        // 读取 BUFFERED_SCATTER（可选）
+        if (cagra.HasMember("BUFFERED_SCATTER") && cagra["BUFFERED_SCATTER"].IsBool())
+        {
+            config.buffered_scatter = cagra["BUFFERED_SCATTER"].GetBool();
+        }
+
+        // 读取 MAX_IN_DEGREE（可选）
+        if (cagra.HasMember("MAX_IN_DEGREE") && cagra["MAX_IN_DEGREE"].IsUint64())
+        {
+            config.max_in_degree = cagra["MAX_IN_DEGREE"].GetUint64();
+        }
+
+        // 读取 FUSED_MERGE（可选）
+        if (cagra.HasMember("FUSED_MERGE") && cagra["FUSED_MERGE"].IsBool())
+        {
+            config.fused_merge = cagra["FUSED_MERGE"].GetBool();
+        }
+
+        // 读取 MERGE_POLICY（可选）
+        if (cagra.HasMember("MERGE_POLICY") && cagra["MERGE_POLICY"].IsString())
+        {
+            config.merge_policy = parseMergePolicy(cagra["MERGE_POLICY"].GetString());
+        }
+
+        // 读取 REVERSE_RATIO（可选）
+        if (cagra.HasMember("REVERSE_RATIO") && cagra["REVERSE_RATIO"].IsNumber())
+        {
+            config.reverse_ratio = cagra["REVERSE_RATIO"].GetDouble();
+            if (config.reverse_ratio < 0 || config.reverse_ratio > 1)
+            {
+                std::cerr << "Error: REVERSE_RATIO must be in [0, 1]." << std::endl;
+                exit(1);
+            }
+        }
+
+        // 读取 REPAIR_CONNECTIVITY（可选）
+        if (cagra.HasMember("REPAIR_CONNECTIVITY") && cagra["REPAIR_CONNECTIVITY"].IsBool())
+        {
+            config.repair_connectivity = cagra["REPAIR_CONNECTIVITY"].GetBool();
+        }
+
+        // 读取 ENTRY_POINTS（可选）
+        if (cagra.HasMember("ENTRY_POINTS") && cagra["ENTRY_POINTS"].IsUint64())
+        {
+            config.entry_points = cagra["ENTRY_POINTS"].GetUint64();
+        }
+
+        // 读取 BASE_PATH、QUERY_PATH（可选）
+        if (cagra.HasMember("BASE_PATH") && cagra["BASE_PATH"].IsString())
+        {
+            config.base_path = cagra["BASE_PATH"].GetString();
+        }
+        if (cagra.HasMember("QUERY_PATH") && cagra["QUERY_PATH"].IsString())
+        {
+            config.query_path = cagra["QUERY_PATH"].GetString();
+        }
+
         return config;
     }
+
+    // 按 KNNG_FORMAT 加载 KNNG，给了 KNNG_DIST_PATH 时一并加载距离
+    Graph<> loadCagraKnng(const CagraConfig &config)
+    {
+        Graph<> knnG;
+        if (config.knng_format == "efanna")
+        {
+            std::cout << "Loading efanna knng from " << config.knng_path << std::endl;
+            knnG.loadKnng(config.knng_path.c_str());
+        }
+        else if (config.knng_format == "fbin")
+        {
+            std::cout << "Loading fbin knng from " << config.knng_path << std::endl;
+            knnG.loadKnngFbin(config.knng_path.c_str());
+        }
+        else
+        {
+            std::cerr << config.knng_format << " is not supported!" << std::endl;
+            exit(-1);
+        }
+        if (!config.knng_dist_path.empty())
+        {
+            std::cout << "Loading knng distances from " << config.knng_dist_path << std::endl;
+            knnG.loadDistsFbin(config.knng_dist_path.c_str());
+        }
+        return knnG;
+    }
+
+    // 由配置和已加载的 KNNG 填好建图参数
+    GraphInfo makeGraphInfo(const CagraConfig &config, const Graph<> &knnG)
+    {
+        GraphInfo info;
+        info.N = knnG.N;
+        info.R_KNNG = knnG.K;
+        info.R_INIT = config.r_init;
+        info.R = config.r;
+        info.R_2HOP = config.r_2hop;
+        info.DETOUR_METRIC = config.detour_metric;
+        info.FIXED_DEGREE = config.fixed_degree;
+        info.BUFFERED_SCATTER = config.buffered_scatter;
+        info.MAX_IN_DEGREE = config.max_in_degree;
+        info.FUSED_MERGE = config.fused_merge;
+        info.MERGE_POLICY = config.merge_policy;
+        info.REVERSE_RATIO = config.reverse_ratio;
+        info.REPAIR_CONNECTIVITY = config.repair_connectivity;
+        info.ENTRY_POINTS = config.entry_points;
+        info.REORDER_ENGINE = config.reorder_engine;
+        info.REORDER_SCHEDULE = config.reorder_schedule;
+        return info;
+    }
 } // namespace cpupg
@@ -0,0 +1,68 @@
+// Last Update: 2026-10-16
+// Description: Hardware cache miss counters for the build stages
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <omp.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cpupg
+{
+  // 统计一个阶段内所有 OpenMP 线程的 LLC miss。
+  // 每个线程各开一个 perf 计数器（只统计自身），结束时求和；
+  // 内核不允许或硬件不支持时 stop() 返回 -1。
+  class CacheMissCounter
+  {
+  public:
+    void start()
+    {
+#if defined(__linux__)
+      fds.assign(omp_get_max_threads(), -1);
+#pragma omp parallel
+      {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fds[omp_get_thread_num()] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+#endif
+    }
+
+    int64_t stop()
+    {
+      int64_t total = -1;
+#if defined(__linux__)
+      for (int fd : fds)
+      {
+        if (fd < 0)
+        {
+          continue;
+        }
+        uint64_t value = 0;
+        if (read(fd, &value, sizeof(value)) == sizeof(value))
+        {
+          total = std::max<int64_t>(total, 0) + value;
+        }
+        close(fd);
+      }
+      fds.clear();
+#endif
+      return total;
+    }
+
+  private:
+    std::vector<int> fds;
+  };
+} // namespace cpupg
@@ -0,0 +1,102 @@
+// Last Update: 2026-10-16
+// Description: Per-thread id -> rank lookup table for the reorder stage
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "memory.hpp"
+
+namespace cpupg
+{
+  // 线性探测的开放寻址表，每线程分配一次。换节点时只递增 epoch 作废所有槽位，
+  // 装载率不超过 1/8，绝大多数查找一次命中
+  class RankTable
+  {
+  public:
+    RankTable() = default;
+
+    explicit RankTable(uint64_t n)
+    {
+      init(n);
+    }
+
+    void init(uint64_t n)
+    {
+      uint32_t bits = 4;
+      while ((1ull << bits) < 8 * n)
+      {
+        bits++;
+      }
+      mask = (1u << bits) - 1;
+      shift = 32 - bits;
+      keys.assign(mask + 1, UINT32_MAX);
+      ranks.assign(mask + 1, 0);
+      stamps.assign(mask + 1, 0);
+      epoch = 1;
+    }
+
+    // 清空表，实际只是推进 epoch
+    void clear()
+    {
+      if (++epoch == 0)
+      {
+        std::fill(stamps.begin(), stamps.end(), 0);
+        epoch = 1;
+      }
+    }
+
+    // 重复插入时保留最后一次的 rank，与 unordered_map::operator[] 行为一致
+    void insert(uint32_t key, int32_t rank)
+    {
+      uint32_t slot = hash(key);
+      while (stamps[slot] == epoch && keys[slot] != key)
+      {
+        slot = (slot + 1) & mask;
+      }
+      stamps[slot] = epoch;
+      keys[slot] = key;
+      ranks[slot] = rank;
+    }
+
+    // 返回 key 的 rank，不存在时返回 -1
+    int32_t find(uint32_t key) const
+    {
+      // 命中与否混在一起判断，循环出口几乎总是可预测的
+      uint32_t slot = hash(key);
+      while (true)
+      {
+        bool live = stamps[slot] == epoch;
+        bool hit = live & (keys[slot] == key);
+        if (hit | !live)
+        {
+          return hit ? ranks[slot] : -1;
+        }
+        slot = (slot + 1) & mask;
+      }
+    }
+
+    static constexpr uint32_t HASH_MUL = 0x9E3779B1u;
+
+    // 以下接口供向量化 kernel 直接访问槽位
+    const uint32_t *slotKeys() const { return keys.data(); }
+    const int32_t *slotRanks() const { return ranks.data(); }
+    const uint32_t *slotStamps() const { return stamps.data(); }
+    uint32_t slotMask() const { return mask; }
+    uint32_t hashShift() const { return shift; }
+    uint32_t currentEpoch() const { return epoch; }
+
+  private:
+    uint32_t hash(uint32_t key) const
+    {
+      return (key * HASH_MUL) >> shift;
+    }
+
+    std::vector<uint32_t, align_alloc<uint32_t>> keys;
+    std::vector<int32_t, align_alloc<int32_t>> ranks;
+    std::vector<uint32_t, align_alloc<uint32_t>> stamps;
+    uint32_t mask = 0;
+    uint32_t shift = 0;
+    uint32_t epoch = 1;
+  };
+} // namespace cpupg
@@ -1,7 +1,13 @@
 #include <cpupg/builder_cagra.hpp>
+#include <cpupg/rank_table.hpp>
+#include <cpupg/perf_counter.hpp>
 #include <algorithm>
+#include <chrono>
+#include <functional>
+#include <type_traits>
 #include <iostream>
 #include <unordered_set>
+#include <unordered_map>
 #include <omp.h>
 #include <assert.h>
 
@@ -9,163 +15,1845 @@
 namespace cpupg
 {
     constexpr int workloads = 100;
+    using Clock = std::chrono::high_resolution_clock;
+
+    static double secondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
     CagraBuilder::CagraBuilder(GraphInfo info) : Builder(info) {}
 
-    const Graph<> &CagraBuilder::build(Graph<> &knnG)
+    // reorder 每行保留的邻居数：前 R 个之后再多留 R / 8 个候选（不超过 R_INIT），
+    // merge 去掉重复边后用它们补齐空出的位置。尾部同样按 (detours, rank) 排序，
+    // 较小 R 的保留列表仍是较大 R 的前缀
+    static uint64_t reorderWidth(uint64_t rInit, uint64_t r)
     {
-        reorder(knnG);
-        reverse();
-        merge();
-        return graph;
+        return std::min(rInit, r + std::max<uint64_t>(r / 8, 1));
     }
 
-    void CagraBuilder::reorder(Graph<> &knnG)
+    // 执行一个阶段，把耗时和 LLC miss 累加到 time / misses 上
+    template <typename F>
+    static void timeStage(F &&stage, double &time, int64_t &misses)
+    {
+        CacheMissCounter counter;
+        auto start = Clock::now();
+        counter.start();
+        stage();
+        int64_t stageMisses = counter.stop();
+        time += secondsSince(start);
+        misses = stageMisses < 0 ? -1 : std::max<int64_t>(misses, 0) + stageMisses;
+    }
+
+    Graph<> CagraBuilder::build(Graph<> &&knnG)
+    {
+        timeStage([&]
+                  { reorder(knnG); }, buildStats.reorder_time, buildStats.reorder_misses);
+        timeStage([&]
+                  { reverse(); }, buildStats.reverse_time, buildStats.reverse_misses);
+        timeStage([&]
+                  { merge(true); }, buildStats.merge_time, buildStats.merge_misses);
+        if (info.ENTRY_POINTS > 0)
+        {
+            timeStage([&]
+                      { computeEntryPoints(); }, buildStats.entry_time, buildStats.entry_misses);
+        }
+        if (info.REPAIR_CONNECTIVITY)
+        {
+            timeStage([&]
+                      { repairConnectivity(); }, buildStats.repair_time, buildStats.repair_misses);
+        }
+        buildStats.peak_memory_mb = peakMemoryMB();
+        return std::move(graph);
+    }
+
+    void CagraBuilder::buildSweep(Graph<> &&knnG, std::vector<uint64_t> rInits, std::vector<uint64_t> rs,
+                                  const std::function<void(uint64_t, uint64_t, const Graph<> &)> &emit)
+    {
+        for (std::vector<uint64_t> *values : {&rInits, &rs})
+        {
+            std::sort(values->begin(), values->end());
+            values->erase(std::unique(values->begin(), values->end()), values->end());
+            assert(!values->empty());
+        }
+        assert(rs.front() > 0);
+        assert(rs.back() <= rInits.front());
+        // reorder 保留前 max(R) 个邻居。(detours, rank) 序下较小 R 的结果就是它的前缀，
+        // reverse 和 merge 只读取每行的前 R 个
+        info.R = rs.back();
+
+        std::vector<Graph<>> sweepG;
+        timeStage([&]
+                  {
+            if (rInits.size() == 1)
+            {
+                info.R_INIT = rInits[0];
+                reorder(knnG);
+                return;
+            }
+            info.R_INIT = rInits.back();
+            sweepG.resize(rInits.size());
+            for (uint64_t b = 0; b < rInits.size(); b++)
+            {
+                sweepG[b].init(info.N, reorderWidth(rInits[b], info.R));
+            }
+            prepareReorder(knnG);
+            // 各 engine 结果相同，这里都用 rank table，只保留是否使用 SIMD 的区别
+            bool simd = info.REORDER_ENGINE == ReorderEngine::SIMD || info.REORDER_ENGINE == ReorderEngine::SORTED_MERGE;
+            reorderSweep(knnG, simd ? detectSimdLevel() : SimdLevel::SCALAR, rInits, sweepG);
+            knnG.destory();
+            std::vector<node_t>().swap(schedule); }, buildStats.reorder_time, buildStats.reorder_misses);
+
+        for (uint64_t b = 0; b < rInits.size(); b++)
+        {
+            if (!sweepG.empty())
+            {
+                info.R_INIT = rInits[b];
+                reorderG.swap(sweepG[b]);
+                sweepG[b].destory();
+            }
+            for (uint64_t r : rs)
+            {
+                info.R = r;
+                timeStage([&]
+                          { reverse(); }, buildStats.reverse_time, buildStats.reverse_misses);
+                timeStage([&]
+                          { merge(r == rs.back()); }, buildStats.merge_time, buildStats.merge_misses);
+                if (info.ENTRY_POINTS > 0)
+                {
+                    timeStage([&]
+                              { computeEntryPoints(); }, buildStats.entry_time, buildStats.entry_misses);
+                }
+                if (info.REPAIR_CONNECTIVITY)
+                {
+                    timeStage([&]
+                              { repairConnectivity(); }, buildStats.repair_time, buildStats.repair_misses);
+                }
+                emit(rInits[b], r, graph);
+            }
+        }
+        buildStats.peak_memory_mb = peakMemoryMB();
+    }
+
+    // 检查参数并做 reorder 前的准备：规范化 R_2HOP，按需生成节点调度顺序
+    void CagraBuilder::prepareReorder(const Graph<> &knnG)
     {
         assert(info.R_INIT <= info.R_KNNG);
-        reorderG.init(info.N, info.R); // 重新排序后的图
-        const int lines = std::max((info.R_INIT * sizeof(int) / CACHELINE), (size_t)1);
-#pragma omp parallel for schedule(dynamic, 100)
-        for (int id_x = 0; id_x < knnG.N; id_x++)
+        assert(info.R <= info.R_INIT);
+        if (info.R_2HOP == 0 || info.R_2HOP > info.R_INIT)
+        {
+            info.R_2HOP = info.R_INIT;
+        }
+        if (info.DETOUR_METRIC == DetourMetric::DISTANCE && knnG.dists == nullptr)
+        {
+            std::cerr << "Error: DETOUR_METRIC distance requires KNNG edge distances (KNNG_DIST_PATH)." << std::endl;
+            exit(1);
+        }
+        if (info.REORDER_SCHEDULE == ReorderSchedule::NN_CLUSTER)
+        {
+            scheduleNNCluster(knnG);
+        }
+    }
+
+    void CagraBuilder::reorder(Graph<> &knnG)
+    {
+        if (info.DETOUR_METRIC == DetourMetric::DISTANCE && info.REORDER_ENGINE == ReorderEngine::SORTED_MERGE)
+        {
+            std::cerr << "Error: REORDER_ENGINE sorted_merge does not support DETOUR_METRIC distance." << std::endl;
+            exit(1);
+        }
+        reorderG.init(info.N, reorderWidth(info.R_INIT, info.R)); // 重新排序后的图
+        prepareReorder(knnG);
+        switch (info.REORDER_ENGINE)
+        {
+        case ReorderEngine::HASH_MAP:
+            reorderHashMap(knnG);
+            break;
+        case ReorderEngine::RANK_TABLE:
+            reorderRankTable(knnG, SimdLevel::SCALAR);
+            break;
+        case ReorderEngine::SIMD:
+        {
+            SimdLevel level = detectSimdLevel();
+#ifdef DEBUG
+            std::cout << "Detour kernel: " << simdLevelName(level) << std::endl;
+#endif
+            reorderRankTable(knnG, level);
+            break;
+        }
+        case ReorderEngine::SORTED_MERGE:
+            reorderSortedMerge(knnG, detectSimdLevel());
+            break;
+        }
+        if (info.R_2HOP < info.R_INIT)
+        {
+            buildStats.reorder_overlap = exactOverlap(knnG);
+        }
+        knnG.destory();
+        std::vector<node_t>().swap(schedule);
+
+#ifdef DEBUG
+        std::cout << "Reordered graph node0's neighbors:" << std::endl;
+        reorderG.debug(0);
+        printMemoryUsage();
+#endif
+    }
+
+    // 每个节点沿最近邻（第 0 个邻居）链走到底，链的终点（互为最近邻的两点中 id 较小者）
+    // 作为簇根。同一簇的节点共享大量邻居，按簇连续排列后，dynamic 调度下同一线程
+    // 会在相近的时间内处理它们，两跳访问的邻接表更可能还在 L2/LLC 中。
+    void CagraBuilder::scheduleNNCluster(const Graph<> &knnG)
+    {
+        const uint64_t N = knnG.N;
+        std::vector<node_t> root(N);
+        std::vector<node_t> next(N);
+#pragma omp parallel for schedule(static)
+        for (uint64_t id_x = 0; id_x < N; id_x++)
+        {
+            node_t id_y = knnG.at(id_x, 0);
+            bool isRoot = id_y == id_x || (knnG.at(id_y, 0) == id_x && id_x < id_y);
+            root[id_x] = isRoot ? id_x : id_y;
+        }
+
+        // pointer jumping，直到所有节点都指向链的终点。KNNG 有并列距离时最近邻链可能
+        // 成环，此时不会收敛，轮数上限 log2(N) 足以走完任何无环链
+        bool changed = true;
+        for (int round = 0; changed && (1ull << round) < N; round++)
         {
-            knnG.prefetch(id_x, lines); // 可能并没有什么用哦
-            std::unordered_map<int, int> neighbors_x;
-            std::vector<std::pair<uint32_t, int>> count(info.R_INIT);
-            for (uint64_t i = 0; i < info.R_INIT; ++i)
+            changed = false;
+#pragma omp parallel for schedule(static) reduction(|| : changed)
+            for (uint64_t id_x = 0; id_x < N; id_x++)
             {
-                int id_y = knnG.at(id_x, i);
-                neighbors_x[id_y] = i;
-                count[i] = {0, id_y};
+                next[id_x] = root[root[id_x]];
+                changed = changed || next[id_x] != root[id_x];
             }
+            root.swap(next);
+        }
+
+        // 按簇根做计数排序，簇内保持 id 顺序
+        std::vector<node_t> offsets(N + 1, 0);
+        for (uint64_t id_x = 0; id_x < N; id_x++)
+        {
+            offsets[root[id_x] + 1]++;
+        }
+        for (uint64_t i = 0; i < N; i++)
+        {
+            offsets[i + 1] += offsets[i];
+        }
+        schedule.resize(N);
+        for (uint64_t id_x = 0; id_x < N; id_x++)
+        {
+            schedule[offsets[root[id_x]]++] = id_x;
+        }
+    }
 
-            for (uint64_t dist_x_y = 0; dist_x_y < info.R_INIT; dist_x_y++)
+    void CagraBuilder::reorderHashMap(Graph<> &knnG)
+    {
+        const int lines = std::max((info.R_INIT * sizeof(int) / CACHELINE), (size_t)1);
+        const bool byDistance = info.DETOUR_METRIC == DetourMetric::DISTANCE;
+#pragma omp parallel
+        {
+            std::vector<uint32_t> offsets;
+#pragma omp for schedule(dynamic, workloads)
+            for (uint64_t i_x = 0; i_x < knnG.N; i_x++)
             {
+                node_t id_x = nodeAt(i_x);
+                knnG.prefetch(id_x, lines); // 可能并没有什么用哦
+                std::unordered_map<node_t, int> neighbors_x;
+                std::vector<uint32_t> detours(info.R_INIT, 0);
+                for (uint64_t i = 0; i < info.R_INIT; ++i)
+                {
+                    neighbors_x[knnG.at(id_x, i)] = i;
+                }
 
-                int32_t id_y = knnG.at(id_x, dist_x_y);
-                knnG.prefetch(knnG.at(id_x, dist_x_y + 1), lines);
-                for (uint64_t dist_y_z = 0; dist_y_z < info.R_INIT; dist_y_z++)
+                for (uint64_t dist_x_y = 0; dist_x_y < info.R_INIT; dist_x_y++)
                 {
-                    int32_t id_z = knnG.at(id_y, dist_y_z);
-                    auto it = neighbors_x.find(id_z);
-                    if (it != neighbors_x.end())
+
+                    node_t id_y = knnG.at(id_x, dist_x_y);
+                    knnG.prefetch(knnG.at(id_x, dist_x_y + 1), lines);
+                    for (uint64_t dist_y_z = 0; dist_y_z < info.R_2HOP; dist_y_z++)
                     {
-                        uint64_t dist_x_z = it->second;
-                        bool detourable = std::max(dist_x_y, dist_y_z) < dist_x_z;
-                        if (detourable)
+                        node_t id_z = knnG.at(id_y, dist_y_z);
+                        auto it = neighbors_x.find(id_z);
+                        if (it != neighbors_x.end())
                         {
-                            count[dist_x_z].first++;
+                            uint64_t dist_x_z = it->second;
+                            bool detourable = byDistance
+                                                  ? std::max(knnG.dist(id_x, dist_x_y), knnG.dist(id_y, dist_y_z)) < knnG.dist(id_x, dist_x_z)
+                                                  : std::max(dist_x_y, dist_y_z) < dist_x_z;
+                            if (detourable)
+                            {
+                                detours[dist_x_z]++;
+                            }
                         }
                     }
                 }
+                emitReordered(id_x, detours.data(), knnG.edges(id_x), info.R_INIT, offsets);
+            }
+        }
+    }
+
+    // 提前结束判断。y 按 rank 升序处理，处理完 rank <= r 的 y 后，rank <= r + 1 的邻居
+    // 的 detour 数不会再变（只有 rank 更小的 y 能绕到它）。若这些已确定的邻居中
+    // 第 K 小的 detour 数不超过所有未确定邻居当前的 detour 数，那么未确定的邻居在
+    // (detours, rank) 序下都排在它们之后，前 K 个已经确定，剩下的 y 不必再扫。
+    class EarlyStop
+    {
+    public:
+        EarlyStop(uint64_t n, uint64_t k) : n(n), k(k), hist(n + 1) {}
+
+        void reset()
+        {
+            std::fill(hist.begin(), hist.end(), 0);
+            hist[0] = 1; // rank 0 的邻居不可能被绕路
+            settled = 1;
+        }
+
+        // 处理完 rank 为 dist_x_y 的 y 之后调用，返回前 K 个是否已确定
+        bool settle(const uint32_t *detours, uint64_t dist_x_y)
+        {
+            if (dist_x_y + 1 >= n)
+            {
+                settled = n;
+                return false;
             }
-            std::sort(count.begin(), count.end(), [](const auto &a, const auto &b)
-                      { return a.first < b.first; });
-            for (uint64_t i = 0; i < reorderG.K; ++i)
+            uint32_t c = detours[dist_x_y + 1];
+            if (c >= hist.size())
             {
-                reorderG.at(id_x, i) = count[i].second;
+                hist.resize(c + 1, 0);
             }
+            hist[c]++;
+            settled = dist_x_y + 2;
+            if (settled < k || settled >= n)
+            {
+                return false;
+            }
+
+            uint32_t kth = 0;
+            for (uint64_t acc = hist[0]; acc < k; acc += hist[++kth])
+                ;
+            for (uint64_t i = settled; i < n; i++)
+            {
+                if (detours[i] < kth)
+                {
+                    return false;
+                }
+            }
+            return true;
         }
-        knnG.destory();
-        
-#ifdef DEBUG
-        std::cout << "Reordered graph node0's neighbors:" << std::endl;
-        reorderG.debug(0);
-        printMemoryUsage();
-#endif
-    }
 
-    void CagraBuilder::reverse()
+        uint64_t settled = 0; // detour 数已确定的邻居个数
+
+    private:
+        uint64_t n;
+        uint64_t k;
+        std::vector<uint64_t> hist; // 已确定邻居的 detour 数直方图
+    };
+
+    void CagraBuilder::reorderRankTable(Graph<> &knnG, SimdLevel level)
     {
-        reversedG.init(reorderG.N, reorderG.K);
-        edgeCount.resize(reversedG.N, 0);
-#pragma omp parallel for schedule(dynamic, workloads)
-        for (int32_t id_x = 0; id_x < reorderG.N; id_x++)
+        const int lines = std::max((info.R_INIT * sizeof(int) / CACHELINE), (size_t)1);
+        const bool byDistance = info.DETOUR_METRIC == DetourMetric::DISTANCE;
+        const DetourKernel kernel = selectDetourKernel(level, info.R_2HOP, info.FIXED_DEGREE);
+        const DetourDistKernel distKernel = selectDetourDistKernel(level, info.R_2HOP, info.FIXED_DEGREE);
+#pragma omp parallel
         {
-            for (uint64_t i = 0; i < reorderG.K; ++i)
+            // 线程私有的查找表和计数数组，只分配一次
+            RankTable neighbors_x(info.R_INIT);
+            EarlyStop earlyStop(info.R_INIT, reorderG.K);
+            std::vector<uint32_t> detours(info.R_INIT);
+            std::vector<uint32_t> offsets;
+#pragma omp for schedule(dynamic, workloads)
+            for (uint64_t i_x = 0; i_x < knnG.N; i_x++)
             {
-                int32_t id_y = reorderG.at(id_x, i);
+                node_t id_x = nodeAt(i_x);
+                knnG.prefetch(id_x, lines);
+                neighbors_x.clear();
+                earlyStop.reset();
+                std::fill(detours.begin(), detours.end(), 0);
+                for (uint64_t i = 0; i < info.R_INIT; ++i)
+                {
+                    neighbors_x.insert(knnG.at(id_x, i), i);
+                }
 
-                // 这里做了去重，保证同一个反向边只出现一次
-                bool flag = true;
-                for (uint64_t j = 0; j < reorderG.K; j++)
+                // 按距离判断时，只有行内距离升序才满足提前结束的前提（rank 小的 y 距离也小）
+                bool canStop = !byDistance || std::is_sorted(knnG.edgeDists(id_x), knnG.edgeDists(id_x) + info.R_INIT);
+                uint64_t settled = info.R_INIT;
+                for (uint64_t dist_x_y = 0; dist_x_y < info.R_INIT; dist_x_y++)
                 {
-                    if (reorderG.at(id_y, j) == id_x)
+                    node_t id_y = knnG.at(id_x, dist_x_y);
+                    knnG.prefetch(knnG.at(id_x, dist_x_y + 1), lines);
+                    if (byDistance)
+                    {
+                        distKernel(neighbors_x, knnG.edgeDists(id_x), knnG.edges(id_y), knnG.edgeDists(id_y), info.R_2HOP,
+                                   knnG.dist(id_x, dist_x_y), detours.data());
+                    }
+                    else
+                    {
+                        kernel(neighbors_x, knnG.edges(id_y), info.R_2HOP, dist_x_y, detours.data());
+                    }
+                    if (canStop && earlyStop.settle(detours.data(), dist_x_y))
                     {
-                        flag = false;
+                        settled = earlyStop.settled;
                         break;
                     }
                 }
-                if (flag)
+                emitReordered(id_x, detours.data(), knnG.edges(id_x), settled, offsets);
+            }
+        }
+    }
+
+    void CagraBuilder::reorderSortedMerge(Graph<> &knnG, SimdLevel level)
+    {
+        assert(info.R_INIT <= 65536);
+        const uint64_t R_INIT = info.R_INIT;
+        const int lines = std::max((R_INIT * sizeof(int) / CACHELINE), (size_t)1);
+
+        // 第一遍：把每个节点的前 R_INIT 个邻居按 id 原地排序，原来的 rank 存到 ranks 中
+        std::vector<uint16_t, align_alloc<uint16_t>> ranks((uint64_t)knnG.N * R_INIT);
+#pragma omp parallel
+        {
+            std::vector<std::pair<node_t, uint16_t>> row(R_INIT);
+#pragma omp for schedule(dynamic, workloads)
+            for (uint64_t id_x = 0; id_x < knnG.N; id_x++)
+            {
+                for (uint64_t i = 0; i < R_INIT; ++i)
+                {
+                    row[i] = {knnG.at(id_x, i), i};
+                }
+                std::sort(row.begin(), row.end());
+                for (uint64_t i = 0; i < R_INIT; ++i)
+                {
+                    knnG.at(id_x, i) = row[i].first;
+                    ranks[id_x * R_INIT + i] = row[i].second;
+                }
+            }
+        }
+
+        // 第二遍：x 的有序邻居与每个 y 的有序邻居求交
+#pragma omp parallel
+        {
+            std::vector<node_t> ids_x(R_INIT);
+            std::vector<uint16_t> ranks_x(R_INIT);
+            std::vector<node_t> byRank(R_INIT);
+            std::vector<uint32_t> detours(R_INIT);
+            std::vector<uint32_t> offsets;
+#pragma omp for schedule(dynamic, workloads)
+            for (uint64_t i_x = 0; i_x < knnG.N; i_x++)
+            {
+                node_t id_x = nodeAt(i_x);
+                const node_t *row = knnG.edges(id_x);
+                const uint16_t *rowRanks = &ranks[id_x * R_INIT];
+
+                // 同一 id 出现多次时只保留最大的 rank，与 hash 表后写覆盖的语义一致
+                uint64_t n_x = 0;
+                for (uint64_t i = 0; i < R_INIT; ++i)
+                {
+                    byRank[rowRanks[i]] = row[i];
+                    if (i + 1 < R_INIT && row[i + 1] == row[i])
+                    {
+                        continue;
+                    }
+                    ids_x[n_x] = row[i];
+                    ranks_x[n_x] = rowRanks[i];
+                    n_x++;
+                }
+                std::fill(detours.begin(), detours.end(), 0);
+
+                // 按 id 顺序访问 y，内存访问更有规律
+                for (uint64_t k = 0; k < R_INIT; k++)
                 {
-                    unsigned pos = 0;
-#pragma omp atomic capture
-                    pos = edgeCount[id_y]++;
+                    node_t id_y = row[k];
+                    if (k + 1 < R_INIT)
+                    {
+                        knnG.prefetch(row[k + 1], lines);
+                    }
+                    countDetoursMerge(ids_x.data(), ranks_x.data(), n_x,
+                                      knnG.edges(id_y), &ranks[id_y * R_INIT], R_INIT,
+                                      info.R_2HOP, rowRanks[k], detours.data(), level);
+                }
+                emitReordered(id_x, detours.data(), byRank.data(), R_INIT, offsets);
+            }
+        }
 
-                    if (pos < reversedG.K)
+        // exactOverlap 需要按 rank 排列的原始 KNNG，恢复被原地排序的行
+        if (info.R_2HOP < R_INIT)
+        {
+#pragma omp parallel
+            {
+                std::vector<node_t> byRank(R_INIT);
+#pragma omp for schedule(dynamic, workloads)
+                for (uint64_t id_x = 0; id_x < knnG.N; id_x++)
+                {
+                    for (uint64_t i = 0; i < R_INIT; ++i)
                     {
-                        reversedG.at(id_y, pos) = id_x;
+                        byRank[ranks[id_x * R_INIT + i]] = knnG.at(id_x, i);
                     }
+                    std::copy(byRank.begin(), byRank.end(), knnG.edges(id_x));
                 }
             }
         }
+    }
 
-#pragma omp parallel for schedule(dynamic, workloads)
-        for (int32_t id_x = 0; id_x < reversedG.N; id_x++)
+    // 按 (detours, rank) 升序取前 k 个写入 out。detour 数不超过 n（除非 KNNG 行内有重复），
+    // 用计数排序即可，rank 顺序扫描保证稳定，结果与线程数无关
+    static void selectTopK(const uint32_t *detours, const node_t *neighbors, uint64_t n, uint64_t k,
+                           std::vector<uint32_t> &offsets, node_t *out)
+    {
+        uint32_t maxCount = *std::max_element(detours, detours + n);
+        offsets.assign(maxCount + 1, 0);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            offsets[detours[i]]++;
+        }
+        uint32_t sum = 0;
+        for (uint32_t &offset : offsets)
+        {
+            uint32_t c = offset;
+            offset = sum;
+            sum += c;
+        }
+        for (uint64_t i = 0; i < n; ++i)
         {
-            for (uint64_t i = edgeCount[id_x]; i < reversedG.K; ++i)
+            uint32_t pos = offsets[detours[i]]++;
+            if (pos < k)
             {
-                reversedG.at(id_x, i) = -1;
+                out[pos] = neighbors[i];
             }
         }
-        
-#ifdef DEBUG
-        std::cout << "Reversed graph node0's neighbors:" << std::endl;
-        reversedG.debug(0);
-        printMemoryUsage();
-#endif
     }
 
-    void CagraBuilder::merge()
+    void CagraBuilder::emitReordered(node_t id_x, const uint32_t *detours, const node_t *neighbors, uint64_t n,
+                                     std::vector<uint32_t> &offsets)
     {
-        const int lines = std::max((info.R * sizeof(int) / CACHELINE / 2), (size_t)1);
-        graph.init(reorderG.N, info.R);
-        graph.prefetch(0, lines);
-        reorderG.prefetch(0, lines);
-        reversedG.prefetch(0, lines);
-#pragma omp parallel for schedule(dynamic, workloads)
-        for (int32_t id_x = 0; id_x < reversedG.N; id_x++)
+        selectTopK(detours, neighbors, n, reorderG.K, offsets, reorderG.edges(id_x));
+    }
+
+    // 多个 R_INIT 共用一次两跳扫描。按 rank 判断时，rank(x,z) < r 的邻居只会被
+    // max(rank(x,y), rank(y,z)) < rank(x,z) < r 的路径绕到，这些路径在 R_INIT = r 时
+    // 同样会被扫描，所以最大 R_INIT 下前 r 个邻居的 detour 数就是 R_INIT = r 的结果。
+    // 按距离判断时没有这个性质，把每条路径按 max(rank(x,y), rank(y,z)) 落在哪个
+    // R_INIT 区间分桶计数，R_INIT = r 的 detour 数是它及更小区间的桶之和。
+    void CagraBuilder::reorderSweep(Graph<> &knnG, SimdLevel level, const std::vector<uint64_t> &rInits,
+                                    std::vector<Graph<>> &outs)
+    {
+        const uint64_t S = rInits.size();
+        const uint64_t R_MAX = rInits.back();
+        const int lines = std::max((R_MAX * sizeof(int) / CACHELINE), (size_t)1);
+        const bool byDistance = info.DETOUR_METRIC == DetourMetric::DISTANCE;
+        const DetourKernel kernel = selectDetourKernel(level, info.R_2HOP, info.FIXED_DEGREE);
+        const DetourKernel anyKernel = selectDetourKernel(level, 0, false);
+        const DetourDistKernel distKernel = selectDetourDistKernel(level, 0, false);
+#pragma omp parallel
         {
-            graph.prefetch(id_x + 1, lines);
-            reorderG.prefetch(id_x + 1, lines);
-            reversedG.prefetch(id_x + 1, lines);
-            uint64_t rSize = edgeCount[id_x]; // 反向图的边数
-            uint64_t sSize = reorderG.K;      // 正向图的边数
-            uint64_t rUse = 0;                // 反向图使用的边数
-            uint64_t sUse = 0;                // 正向图使用的边数
-            if (rSize < sSize / 2)
+            RankTable neighbors_x(R_MAX);
+            std::vector<EarlyStop> earlyStops;
+            for (uint64_t b = 0; b < S; b++)
             {
-                rUse = rSize;
-                sUse = sSize - rSize;
+                earlyStops.emplace_back(rInits[b], outs[b].K);
             }
-            else
+            std::vector<uint64_t> settled(S);
+            std::vector<uint32_t> detours(S * R_MAX); // 按距离判断时每个 R_INIT 区间一个桶
+            std::vector<uint32_t> offsets;
+#pragma omp for schedule(dynamic, workloads)
+            for (uint64_t i_x = 0; i_x < knnG.N; i_x++)
             {
-                rUse = sSize / 2;
-                sUse = sSize - rUse;
+                node_t id_x = nodeAt(i_x);
+                const node_t *row = knnG.edges(id_x);
+                knnG.prefetch(id_x, lines);
+                neighbors_x.clear();
+                for (uint64_t i = 0; i < R_MAX; ++i)
+                {
+                    neighbors_x.insert(row[i], i);
+                }
+
+                // 行内有重复 id 时 rank 表后写覆盖，较小的 R_INIT 看到的 rank 不同，逐个单独计算
+                bool unique = true;
+                for (uint64_t i = 0; i < R_MAX && unique; ++i)
+                {
+                    unique = neighbors_x.find(row[i]) == (int)i;
+                }
+                if (!unique)
+                {
+                    for (uint64_t b = 0; b < S; b++)
+                    {
+                        const uint64_t r = rInits[b];
+                        const uint64_t r2hop = std::min(info.R_2HOP, r);
+                        neighbors_x.clear();
+                        for (uint64_t i = 0; i < r; ++i)
+                        {
+                            neighbors_x.insert(row[i], i);
+                        }
+                        std::fill(detours.begin(), detours.begin() + r, 0);
+                        for (uint64_t dist_x_y = 0; dist_x_y < r; dist_x_y++)
+                        {
+                            node_t id_y = row[dist_x_y];
+                            if (byDistance)
+                            {
+                                distKernel(neighbors_x, knnG.edgeDists(id_x), knnG.edges(id_y), knnG.edgeDists(id_y), r2hop,
+                                           knnG.dist(id_x, dist_x_y), detours.data());
+                            }
+                            else
+                            {
+                                anyKernel(neighbors_x, knnG.edges(id_y), r2hop, dist_x_y, detours.data());
+                            }
+                        }
+                        selectTopK(detours.data(), row, r, outs[b].K, offsets, outs[b].edges(id_x));
+                    }
+                    continue;
+                }
+
+                std::fill(detours.begin(), detours.end(), 0);
+                if (byDistance)
+                {
+                    // y 的邻居按 rank 切成各 R_INIT 区间，分别计入 max(rank(x,y), rank(y,z)) 所在的桶
+                    uint64_t first = 0; // rank(x,y) 所在的区间
+                    for (uint64_t dist_x_y = 0; dist_x_y < R_MAX; dist_x_y++)
+                    {
+                        while (dist_x_y >= rInits[first])
+                        {
+                            first++;
+                        }
+                        node_t id_y = row[dist_x_y];
+                        knnG.prefetch(row[dist_x_y + 1], lines);
+                        for (uint64_t b = first; b < S; b++)
+                        {
+                            uint64_t begin = b == first ? 0 : rInits[b - 1];
+                            uint64_t end = std::min(rInits[b], info.R_2HOP);
+                            if (begin >= end)
+                            {
+                                break;
+                            }
+                            distKernel(neighbors_x, knnG.edgeDists(id_x), knnG.edges(id_y) + begin, knnG.edgeDists(id_y) + begin,
+                                       end - begin, knnG.dist(id_x, dist_x_y), &detours[b * R_MAX]);
+                        }
+                    }
+                    for (uint64_t b = 0; b < S; b++)
+                    {
+                        if (b > 0)
+                        {
+                            for (uint64_t i = 0; i < R_MAX; ++i)
+                            {
+                                detours[b * R_MAX + i] += detours[(b - 1) * R_MAX + i];
+                            }
+                        }
+                        selectTopK(&detours[b * R_MAX], row, rInits[b], outs[b].K, offsets, outs[b].edges(id_x));
+                    }
+                    continue;
+                }
+
+                // 按 rank 判断时所有 R_INIT 共用一个计数数组，各自判断提前结束
+                uint64_t open = S;
+                for (uint64_t b = 0; b < S; b++)
+                {
+                    earlyStops[b].reset();
+                    settled[b] = 0;
+                }
+                for (uint64_t dist_x_y = 0; dist_x_y < R_MAX && open > 0; dist_x_y++)
+                {
+                    node_t id_y = row[dist_x_y];
+                    knnG.prefetch(row[dist_x_y + 1], lines);
+                    kernel(neighbors_x, knnG.edges(id_y), info.R_2HOP, dist_x_y, detours.data());
+                    for (uint64_t b = 0; b < S; b++)
+                    {
+                        if (settled[b] != 0)
+                        {
+                            continue;
+                        }
+                        if (earlyStops[b].settle(detours.data(), dist_x_y))
+                        {
+                            settled[b] = earlyStops[b].settled;
+                            open--;
+                        }
+                        else if (dist_x_y + 1 >= rInits[b])
+                        {
+                            settled[b] = rInits[b];
+                            open--;
+                        }
+                    }
+                }
+                for (uint64_t b = 0; b < S; b++)
+                {
+                    selectTopK(detours.data(), row, settled[b], outs[b].K, offsets, outs[b].edges(id_x));
+                }
             }
-            for (uint64_t i = 0; i < sUse; i++)
+        }
+    }
+
+    // R_2HOP < R_INIT 时，抽样一部分节点按完整的 R_INIT x R_INIT 两跳重新计算，
+    // 返回近似结果与精确结果前 R 个邻居的平均重合率
+    double CagraBuilder::exactOverlap(const Graph<> &knnG)
+    {
+        constexpr uint64_t samples = 1000;
+        const uint64_t step = std::max<uint64_t>(knnG.N / samples, 1);
+        const uint64_t K = info.R;
+        uint64_t overlap = 0;
+        uint64_t total = 0;
+#pragma omp parallel reduction(+ : overlap, total)
+        {
+            RankTable neighbors_x(info.R_INIT);
+            std::vector<uint32_t> detours(info.R_INIT);
+            std::vector<uint32_t> offsets;
+            std::vector<node_t> exact(K);
+#pragma omp for schedule(dynamic, 1)
+            for (uint64_t id_x = 0; id_x < knnG.N; id_x += step)
             {
-                graph.at(id_x, i) = reorderG.at(id_x, i);
+                neighbors_x.clear();
+                std::fill(detours.begin(), detours.end(), 0);
+                for (uint64_t i = 0; i < info.R_INIT; ++i)
+                {
+                    neighbors_x.insert(knnG.at(id_x, i), i);
+                }
+                for (uint64_t dist_x_y = 0; dist_x_y < info.R_INIT; dist_x_y++)
+                {
+                    node_t id_y = knnG.at(id_x, dist_x_y);
+                    if (info.DETOUR_METRIC == DetourMetric::DISTANCE)
+                    {
+                        countDetoursDist(neighbors_x, knnG.edgeDists(id_x), knnG.edges(id_y), knnG.edgeDists(id_y), info.R_INIT,
+                                         knnG.dist(id_x, dist_x_y), detours.data(), SimdLevel::SCALAR);
+                    }
+                    else
+                    {
+                        countDetours(neighbors_x, knnG.edges(id_y), info.R_INIT, dist_x_y, detours.data(), SimdLevel::SCALAR);
+                    }
+                }
+                selectTopK(detours.data(), knnG.edges(id_x), info.R_INIT, K, offsets, exact.data());
+                for (uint64_t i = 0; i < K; ++i)
+                {
+                    overlap += std::count(exact.begin(), exact.end(), reorderG.at(id_x, i)) > 0;
+                }
+                total += K;
             }
-            for (uint64_t i = 0; i < rUse; i++)
+        }
+        return (double)overlap / total;
+    }
+
+    // 以编译期常量度数调用 f，enabled 为假或度数不在常用列表中时以 0 调用（通用版本）
+    template <typename F>
+    static void withFixedDegree(uint64_t degree, bool enabled, F &&f)
+    {
+        if (enabled)
+        {
+            switch (degree)
             {
-                graph.at(id_x, i + sUse) = reversedG.at(id_x, i);
+            case 32:
+                f(std::integral_constant<uint64_t, 32>());
+                return;
+            case 48:
+                f(std::integral_constant<uint64_t, 48>());
+                return;
+            case 64:
+                f(std::integral_constant<uint64_t, 64>());
+                return;
+            case 96:
+                f(std::integral_constant<uint64_t, 96>());
+                return;
             }
         }
-        
-#ifdef DEBUG
-        std::cout << "Merged graph node0's neighbors:" << std::endl;
-        graph.debug(0);
-        printMemoryUsage();
-#endif
+        f(std::integral_constant<uint64_t, 0>());
+    }
+
+    void CagraBuilder::reverse()
+    {
+        withFixedDegree(info.R, info.FIXED_DEGREE, [this](auto degree)
+                        { reverseFixed<decltype(degree)::value>(); });
+    }
+
+    // 反向边按目标节点所在的块（2^bits 个连续节点）分区，块内下标用 uint16_t 存，块最大 2^16 个节点
+    constexpr int REVERSE_BLOCK_BITS = 16;
+    constexpr uint64_t REVERSE_CACHE_BYTES = 1 << 20; // 块处理时希望留在 L2 中的数据量
+    constexpr int64_t REVERSE_MAX_BLOCKS = 1 << 16;   // 块数上限，限制每线程的计数和缓冲区大小
+    constexpr uint64_t SCATTER_BUFFER = 16;            // 每线程每块缓冲的边数，写满后整段写出
+    constexpr uint64_t STAGED_EDGE_BYTES = sizeof(node_t) + sizeof(uint16_t) + sizeof(uint8_t); // 暂存一条边的 (x, y, rank)
+
+    // 块的大小。BUFFERED_SCATTER 时让一个块的 reorderG 行、reversedG 行和暂存的边都能放进
+    // L2，否则固定为 2^16 个节点
+    static int reverseBlockBits(int64_t n, uint64_t k, bool buffered)
+    {
+        if (!buffered)
+        {
+            return REVERSE_BLOCK_BITS;
+        }
+        int bits = 8;
+        // 每个节点约占 k 个 id 的 reorderG 行、reversedG 行和 k 条暂存边
+        while (bits < REVERSE_BLOCK_BITS && (2ull << bits) * k * (2 * sizeof(node_t) + STAGED_EDGE_BYTES) <= REVERSE_CACHE_BYTES)
+        {
+            bits++;
+        }
+        while (bits < REVERSE_BLOCK_BITS && ((n - 1) >> bits) >= REVERSE_MAX_BLOCKS)
+        {
+            bits++;
+        }
+        return bits;
     }
+
+    // 把 [0, n) 切成 parts 段连续区间。各段在 omp for 中按段号处理，parallel 区域实际
+    // 得到的线程数少于 parts 时一个线程处理多段，每段仍都会处理，结果与线程数无关
+    struct Partition
+    {
+        int64_t n;
+        int64_t parts;
+        int64_t chunk;
+
+        Partition(int64_t n, int64_t parts) : n(n), parts(parts), chunk((n + parts - 1) / parts) {}
+        int64_t begin(int64_t t) const { return std::min(n, t * chunk); }
+        int64_t end(int64_t t) const { return std::min(n, begin(t) + chunk); }
+    };
+
+    // merge 一行用到的候选。forward 是 reorder 的结果，前 K 个之后是多保留的尾部，共 width 个；
+    // reverse 是按 (rank, 源 id) 排好的反向边
+    struct MergeSource
+    {
+        node_t id;
+        const node_t *forward;
+        uint64_t width;
+        const uint8_t *reciprocal; // forward 前 K 个是否互为邻居，RECIPROCAL_FIRST 使用
+        const node_t *reverse;
+        const uint8_t *reverseRanks; // 反向边在源节点行中的 rank（超过 255 记为 255），INTERLEAVE 使用
+        uint64_t rSize;              // 反向边总数，可能多于 reverse 中保存的
+    };
+
+    // 每行最多使用的反向边数
+    static uint64_t reverseQuota(uint64_t K, double ratio)
+    {
+        return std::min<uint64_t>(K, K * ratio);
+    }
+
+    // 按 policy 拼出最终的一行，共 K 个，其中反向边不超过 rQuota 条。空位、自环和重复的 id
+    // 不占位置，空出的位置按顺序用 forward 中剩下的候选补齐，候选用完时才留 -1。
+    // seen 记录已放入的 id
+    static inline void mergeRow(MergePolicy policy, uint64_t rQuota, const MergeSource &src, uint64_t K,
+                                RankTable &seen, node_t *out)
+    {
+        const uint64_t rUse = std::min(src.rSize, rQuota); // 反向图使用的边数
+        const uint64_t sUse = K - rUse;                     // 正向图使用的边数
+        uint64_t n = 0;
+        seen.clear();
+        auto push = [&](node_t id)
+        {
+            if (id != EMPTY_ID && id != src.id && seen.find(id) < 0)
+            {
+                seen.insert(id, n);
+                out[n++] = id;
+            }
+        };
+        switch (policy)
+        {
+        case MergePolicy::FORWARD_FIRST:
+            for (uint64_t i = 0; i < sUse; i++)
+            {
+                push(src.forward[i]);
+            }
+            for (uint64_t i = 0; i < rUse; i++)
+            {
+                push(src.reverse[i]);
+            }
+            break;
+        case MergePolicy::INTERLEAVE:
+        {
+            // 两个列表都按 rank 升序，rank 相同时正向边在前，反向边用满 rUse 条后只取正向边
+            uint64_t i = 0;
+            uint64_t j = 0;
+            while (n < K && (i < src.width || j < rUse))
+            {
+                if (j < rUse && (i >= src.width || src.reverseRanks[j] < i))
+                {
+                    push(src.reverse[j++]);
+                }
+                else
+                {
+                    push(src.forward[i++]);
+                }
+            }
+            break;
+        }
+        case MergePolicy::RECIPROCAL_FIRST:
+        {
+            // 前 K 个正向边中先取互为邻居的，再按 rank 取其余的，共 sUse 个
+            uint64_t taken = 0;
+            for (uint8_t want : {1, 0})
+            {
+                for (uint64_t i = 0; i < K && taken < sUse; i++)
+                {
+                    if (src.reciprocal[i] == want)
+                    {
+                        push(src.forward[i]);
+                        taken++;
+                    }
+                }
+            }
+            for (uint64_t i = 0; i < rUse; i++)
+            {
+                push(src.reverse[i]);
+            }
+            break;
+        }
+        }
+        for (uint64_t i = 0; i < src.width && n < K; i++)
+        {
+            push(src.forward[i]);
+        }
+        std::fill(out + n, out + K, EMPTY_ID);
+    }
+
+    // 不用原子操作的转置：所有边按 (目标块, 线程) 计数，前缀和之后各线程把
+    // (y, x, rank(x,y)) 写到自己独占的区间，最后每个块由一个线程按 (y, rank) 做两次
+    // 稳定的计数排序，去掉 y 的邻居中已有的 x 后填入 reversedG。每个节点的反向边按
+    // (rank(x,y), x) 升序，超过 K 条时保留最靠前的 K 条，结果与线程数无关。
+    // fusedMerge() 时不分配 reversedG，块内每个 y 的反向边排好后直接与正向边拼成 graph
+    // 的一行；暂存区也按目标块分轮使用，每轮不超过 reorderG 的一半，峰值内存约为
+    // reorderG 的 2.5 倍，而分开做时是 reorderG、reversedG 加上 7/4 倍的暂存区
+    template <uint64_t R_C>
+    void CagraBuilder::reverseFixed()
+    {
+        const uint64_t K = R_C ? R_C : info.R; // 只使用 reorderG 每行的前 R 个
+        const int64_t N = reorderG.N;
+        const bool fused = fusedMerge();
+        const uint64_t width = reorderWidth(info.R_INIT, K); // merge 可用的正向候选数
+        const uint64_t rQuota = reverseQuota(K, info.REVERSE_RATIO);
+        const bool keepRanks = info.MERGE_POLICY == MergePolicy::INTERLEAVE;
+        const bool keepReciprocal = info.MERGE_POLICY == MergePolicy::RECIPROCAL_FIRST;
+        reversedG.destory();
+        graph.destory();
+        std::vector<uint8_t>().swap(reverseRanks);
+        std::vector<uint8_t>().swap(reciprocal);
+        if (fused)
+        {
+            graph.allocate(N, K); // block pass 会写满每一行
+            std::vector<uint64_t>().swap(edgeCount);
+        }
+        else
+        {
+            reversedG.init(N, K); // init 已把所有位置填为 -1
+            edgeCount.assign(N, 0);
+            // 策略需要的附加信息按 reversedG / reorderG 前 K 列的位置保存，供 merge 使用
+            reverseRanks.resize(keepRanks ? N * K : 0);
+            reciprocal.resize(keepReciprocal ? N * K : 0);
+        }
+
+        // 源节点切成 T 个连续的段
+        const int64_t T = omp_get_max_threads();
+        const Partition sources(N, T);
+        const int blockBits = reverseBlockBits(N, K, info.BUFFERED_SCATTER);
+        const int64_t blockSize = 1ll << blockBits;
+        const int64_t blocks = (N + blockSize - 1) >> blockBits;
+        std::vector<uint64_t> offsets(blocks * T + 1, 0); // 下标为 block * T + t
+
+        // 第一遍：按目标块计数
+#pragma omp parallel for schedule(static, 1)
+        for (int64_t t = 0; t < T; t++)
+        {
+            for (int64_t id_x = sources.begin(t); id_x < sources.end(t); id_x++)
+            {
+                for (uint64_t i = 0; i < K; ++i)
+                {
+                    offsets[(reorderG.at(id_x, i) >> blockBits) * T + t + 1]++;
+                }
+            }
+        }
+        for (int64_t i = 0; i < blocks * T; i++)
+        {
+            offsets[i + 1] += offsets[i];
+        }
+
+        // 按目标块切成若干轮，每轮暂存的边不超过 roundEdges（至少一个块），不融合时只有一轮
+        const uint64_t roundEdges = fused ? std::max<uint64_t>(N * K * sizeof(node_t) / 2 / STAGED_EDGE_BYTES, 1)
+                                          : offsets.back();
+        std::vector<int64_t> rounds = {0};
+        uint64_t maxRound = 0;
+        for (int64_t block = 0; block < blocks; block++)
+        {
+            const uint64_t base = offsets[rounds.back() * T];
+            if (block > rounds.back() && offsets[(block + 1) * T] - base > roundEdges)
+            {
+                maxRound = std::max(maxRound, offsets[block * T] - base);
+                rounds.push_back(block);
+            }
+        }
+        maxRound = std::max(maxRound, offsets.back() - offsets[rounds.back() * T]);
+        rounds.push_back(blocks);
+
+        std::vector<node_t> srcs(maxRound);
+        std::vector<uint16_t> dsts(maxRound);
+        std::vector<uint8_t> ranks(maxRound);
+        for (size_t round = 0; round + 1 < rounds.size(); round++)
+        {
+            const int64_t blockBegin = rounds[round];
+            const int64_t blockEnd = rounds[round + 1];
+            const uint64_t roundBase = offsets[blockBegin * T];
+
+            // 第二遍：每段把本轮目标块的 (y, x, rank) 写到该段在每个块中的区间，rank 超过
+            // 255 的记为 255。BUFFERED_SCATTER 时先攒在线程私有的小缓冲区里，满 SCATTER_BUFFER
+            // 条再连续写出一段，代替每条边一次分散的写入
+#pragma omp parallel
+            {
+                std::vector<uint64_t> pos(blocks);
+                std::vector<node_t, align_alloc<node_t>> bufSrcs(info.BUFFERED_SCATTER ? blocks * SCATTER_BUFFER : 0);
+                std::vector<uint16_t, align_alloc<uint16_t>> bufDsts(info.BUFFERED_SCATTER ? blocks * SCATTER_BUFFER : 0);
+                std::vector<uint8_t, align_alloc<uint8_t>> bufRanks(info.BUFFERED_SCATTER ? blocks * SCATTER_BUFFER : 0);
+                std::vector<uint32_t> fill(info.BUFFERED_SCATTER ? blocks : 0, 0);
+                auto flush = [&](int64_t block, uint32_t n)
+                {
+                    uint64_t p = pos[block];
+                    uint64_t b = block * SCATTER_BUFFER;
+                    std::copy(&bufSrcs[b], &bufSrcs[b] + n, &srcs[p]);
+                    std::copy(&bufDsts[b], &bufDsts[b] + n, &dsts[p]);
+                    std::copy(&bufRanks[b], &bufRanks[b] + n, &ranks[p]);
+                    pos[block] = p + n;
+                };
+#pragma omp for schedule(static, 1)
+                for (int64_t t = 0; t < T; t++)
+                {
+                    for (int64_t block = blockBegin; block < blockEnd; block++)
+                    {
+                        pos[block] = offsets[block * T + t] - roundBase;
+                    }
+                    if (info.BUFFERED_SCATTER)
+                    {
+                        for (int64_t id_x = sources.begin(t); id_x < sources.end(t); id_x++)
+                        {
+                            for (uint64_t i = 0; i < K; ++i)
+                            {
+                                node_t id_y = reorderG.at(id_x, i);
+                                int64_t block = id_y >> blockBits;
+                                if (block < blockBegin || block >= blockEnd)
+                                {
+                                    continue;
+                                }
+                                uint64_t b = block * SCATTER_BUFFER + fill[block];
+                                bufSrcs[b] = id_x;
+                                bufDsts[b] = id_y & (blockSize - 1);
+                                bufRanks[b] = std::min<uint64_t>(i, UINT8_MAX);
+                                if (++fill[block] == SCATTER_BUFFER)
+                                {
+                                    flush(block, SCATTER_BUFFER);
+                                    fill[block] = 0;
+                                }
+                            }
+                        }
+                        // 缓冲区中的边属于段 t 的区间，换段前全部写出
+                        for (int64_t block = blockBegin; block < blockEnd; block++)
+                        {
+                            flush(block, fill[block]);
+                            fill[block] = 0;
+                        }
+                    }
+                    else
+                    {
+                        for (int64_t id_x = sources.begin(t); id_x < sources.end(t); id_x++)
+                        {
+                            for (uint64_t i = 0; i < K; ++i)
+                            {
+                                node_t id_y = reorderG.at(id_x, i);
+                                int64_t block = id_y >> blockBits;
+                                if (block < blockBegin || block >= blockEnd)
+                                {
+                                    continue;
+                                }
+                                uint64_t p = pos[block]++;
+                                srcs[p] = id_x;
+                                dsts[p] = id_y & (blockSize - 1);
+                                ranks[p] = std::min<uint64_t>(i, UINT8_MAX);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // 第三遍：块内的边已按源节点顺序排列，先按 rank 再按 y 做稳定的计数排序，
+            // 得到 (y, rank, x) 序。每个 y 只读一次自己的行放进 rank 表，
+            // 判断 x 是否已是 y 的邻居只需 O(1) 的查找，不再随机读 y 的整行
+#pragma omp parallel
+            {
+                RankTable neighbors_y(K);
+                std::vector<uint32_t> byRank;
+                std::vector<uint32_t> byDst;
+                std::vector<uint32_t> rankStart(UINT8_MAX + 2);
+                std::vector<uint32_t> dstStart(blockSize + 1);
+                // 融合时 merge 最多用到 rQuota 条反向边，只需在本地保留这么多
+                std::vector<node_t> reverse_y(fused ? rQuota : 0);
+                std::vector<uint8_t> reverseRanks_y(fused ? rQuota : 0);
+                std::vector<uint8_t> reciprocal_y(fused ? K : 0);
+#pragma omp for schedule(dynamic, 1)
+                for (int64_t block = blockBegin; block < blockEnd; block++)
+                {
+                    const int64_t base = block << blockBits;
+                    const int64_t rows = std::min(blockSize, N - base);
+                    const uint64_t first = offsets[block * T] - roundBase;
+                    const uint64_t count = offsets[(block + 1) * T] - offsets[block * T];
+                    std::fill(rankStart.begin(), rankStart.end(), 0);
+                    std::fill(dstStart.begin(), dstStart.end(), 0);
+                    for (uint64_t p = first; p < first + count; p++)
+                    {
+                        rankStart[ranks[p] + 1]++;
+                        dstStart[dsts[p] + 1]++;
+                    }
+                    for (uint64_t r = 0; r <= UINT8_MAX; r++)
+                    {
+                        rankStart[r + 1] += rankStart[r];
+                    }
+                    for (int64_t y = 0; y < rows; y++)
+                    {
+                        dstStart[y + 1] += dstStart[y];
+                    }
+                    byRank.resize(count);
+                    byDst.resize(count);
+                    for (uint64_t p = first; p < first + count; p++)
+                    {
+                        byRank[rankStart[ranks[p]]++] = p - first;
+                    }
+                    for (uint32_t q = 0; q < count; q++)
+                    {
+                        byDst[dstStart[dsts[first + byRank[q]]]++] = byRank[q];
+                    }
+
+                    // 计数排序后 dstStart[y] 指向 y 的区间末尾
+                    uint32_t q = 0;
+                    for (int64_t y = 0; y < rows; y++)
+                    {
+                        const int64_t id_y = base + y;
+                        neighbors_y.clear();
+                        for (uint64_t j = 0; j < K; j++)
+                        {
+                            neighbors_y.insert(reorderG.at(id_y, j), j);
+                        }
+                        node_t *out = fused ? reverse_y.data() : reversedG.edges(id_y);
+                        uint8_t *outRanks = !keepRanks ? nullptr : fused ? reverseRanks_y.data() : &reverseRanks[id_y * K];
+                        uint8_t *outReciprocal = !keepReciprocal ? nullptr : fused ? reciprocal_y.data() : &reciprocal[id_y * K];
+                        if (outReciprocal != nullptr)
+                        {
+                            std::fill(outReciprocal, outReciprocal + K, 0);
+                        }
+                        const uint64_t limit = fused ? rQuota : K;
+                        // 这里做了去重，保证同一个反向边只出现一次；已是 y 的邻居的 x 说明 y -> x 互为邻居
+                        uint64_t n = 0;
+                        for (; q < dstStart[y]; q++)
+                        {
+                            const uint64_t p = first + byDst[q];
+                            node_t id_x = srcs[p];
+                            int32_t j = neighbors_y.find(id_x);
+                            if (j < 0)
+                            {
+                                if (n < limit)
+                                {
+                                    out[n] = id_x;
+                                    if (outRanks != nullptr)
+                                    {
+                                        outRanks[n] = ranks[p];
+                                    }
+                                }
+                                n++;
+                            }
+                            else if (outReciprocal != nullptr)
+                            {
+                                outReciprocal[j] = 1;
+                            }
+                        }
+                        if (fused)
+                        {
+                            // neighbors_y 已用完，拿来给 merge 去重
+                            MergeSource src = {(node_t)id_y, reorderG.edges(id_y), width, outReciprocal, out, outRanks, n};
+                            mergeRow(info.MERGE_POLICY, rQuota, src, K, neighbors_y, graph.edges(id_y));
+                        }
+                        else
+                        {
+                            edgeCount[id_y] = n;
+                        }
+                    }
+                }
+            }
+        }
+
+#ifdef DEBUG
+        std::cout << "Reversed graph node0's neighbors:" << std::endl;
+        (fused ? graph : reversedG).debug(0);
+        printMemoryUsage();
+#endif
+    }
+
+    void CagraBuilder::merge(bool inPlace)
+    {
+        // 融合时 graph 已在 reverse 中拼好
+        if (!fusedMerge())
+        {
+            // 入度均衡还要从 reorderG 中找替代边，此时不能覆盖
+            const bool overwrite = inPlace && info.MAX_IN_DEGREE == 0;
+            withFixedDegree(info.R, info.FIXED_DEGREE, [this, overwrite](auto degree)
+                            { mergeFixed<decltype(degree)::value>(overwrite); });
+        }
+        if (info.MAX_IN_DEGREE > 0)
+        {
+            balanceInDegree(info.R);
+        }
+        // 反向边和附加信息只有 merge 和入度均衡会读
+        reversedG.destory();
+        std::vector<uint64_t>().swap(edgeCount);
+        std::vector<uint8_t>().swap(reverseRanks);
+        std::vector<uint8_t>().swap(reciprocal);
+        // 融合或入度均衡时 reorderG 没有被覆盖，在这里释放，之后的阶段只保留 graph
+        if (inPlace)
+        {
+            reorderG.destory();
+        }
+
+#ifdef DEBUG
+        std::cout << "Merged graph node0's neighbors:" << std::endl;
+        graph.debug(0);
+        printMemoryUsage();
+#endif
+    }
+
+    constexpr int64_t IN_PLACE_CHUNK = 1 << 16; // 原地 merge 每批处理的行数
+
+    // inPlace 时结果直接写回 reorderG 的内存再交给 graph，不再分配新的 N x R 数组。
+    // reorderG 每行有 width >= K 个，第 x 行的结果只会覆盖第 x 行及之前的输入，
+    // 所以按批处理：一批行先并行写到缓冲区，全部算完后再拷回各自的位置
+    template <uint64_t R_C>
+    void CagraBuilder::mergeFixed(bool inPlace)
+    {
+        const uint64_t K = R_C ? R_C : info.R; // 只使用 reorderG 每行的前 R 个
+        const uint64_t width = reorderWidth(info.R_INIT, K);
+        const uint64_t rQuota = reverseQuota(K, info.REVERSE_RATIO);
+        const int64_t N = reorderG.N;
+        const int lines = std::max((K * sizeof(int) / CACHELINE / 2), (size_t)1);
+        const int64_t chunk = inPlace ? IN_PLACE_CHUNK : N;
+        std::vector<node_t> buffer(inPlace ? std::min(N, chunk) * K : 0);
+        if (!inPlace)
+        {
+            graph.allocate(N, K); // 每行都会写满，不必先填 -1
+        }
+        node_t *out = inPlace ? buffer.data() : graph.data;
+        reorderG.prefetch(0, lines);
+        reversedG.prefetch(0, lines);
+#pragma omp parallel
+        {
+            RankTable seen(K);
+            for (int64_t begin = 0; begin < N; begin += chunk)
+            {
+                const int64_t end = std::min(N, begin + chunk);
+#pragma omp for schedule(dynamic, workloads)
+                for (int64_t id_x = begin; id_x < end; id_x++)
+                {
+                    reorderG.prefetch(id_x + 1, lines);
+                    reversedG.prefetch(id_x + 1, lines);
+                    MergeSource src = {(node_t)id_x, reorderG.edges(id_x), width,
+                                       reciprocal.empty() ? nullptr : &reciprocal[id_x * K],
+                                       reversedG.edges(id_x),
+                                       reverseRanks.empty() ? nullptr : &reverseRanks[id_x * K],
+                                       edgeCount[id_x]};
+                    mergeRow(info.MERGE_POLICY, rQuota, src, K, seen, out + (id_x - (inPlace ? begin : 0)) * K);
+                }
+                if (inPlace)
+                {
+#pragma omp for schedule(static)
+                    for (int64_t id_x = begin; id_x < end; id_x++)
+                    {
+                        std::copy(&buffer[(id_x - begin) * K], &buffer[(id_x - begin) * K] + K, reorderG.data + id_x * K);
+                    }
+                }
+            }
+        }
+        if (inPlace)
+        {
+            reorderG.shrinkDegree(K);
+            graph.swap(reorderG);
+            reorderG.destory();
+        }
+    }
+
+    // 统计 graph 中每个节点的入度
+    static void countInDegree(const Graph<> &g, std::vector<uint32_t> &inDegree)
+    {
+        inDegree.assign(g.N, 0);
+#pragma omp parallel for schedule(dynamic, workloads)
+        for (uint64_t id_x = 0; id_x < g.N; id_x++)
+        {
+            for (uint64_t j = 0; j < g.K; j++)
+            {
+                node_t id_z = g.at(id_x, j);
+                if (id_z != EMPTY_ID)
+                {
+#pragma omp atomic
+                    inDegree[id_z]++;
+                }
+            }
+        }
+    }
+
+    // 入度直方图：第 0 个桶为入度 0，第 i 个桶为入度落在 [2^(i-1), 2^i) 的节点数
+    static std::vector<uint64_t> inDegreeHistogram(const std::vector<uint32_t> &inDegree)
+    {
+        std::vector<uint64_t> hist;
+        for (uint32_t d : inDegree)
+        {
+            size_t bucket = d == 0 ? 0 : 32 - __builtin_clz(d);
+            if (bucket >= hist.size())
+            {
+                hist.resize(bucket + 1, 0);
+            }
+            hist[bucket]++;
+        }
+        return hist;
+    }
+
+    // 入度超过 MAX_IN_DEGREE 的 hub 只保留在各行中位置最靠前的入边（按位置计数取阈值，
+    // 只有第 0 个位置的入边就超过上限时才连第 0 个邻居也去掉）。每个节点的余量是
+    // MAX_IN_DEGREE 减去去边后的入度，被去掉的位置依次改用该行未用上的正向边、反向边中
+    // 还有余量的节点；找不到时该位置留空，行内其余邻居前移。余量按行号顺序分配，
+    // 结果与线程数无关，均衡后每个节点的入度都不超过 MAX_IN_DEGREE
+    void CagraBuilder::balanceInDegree(uint64_t K)
+    {
+        const uint64_t N = graph.N;
+        const uint64_t H = info.MAX_IN_DEGREE;
+        const uint64_t width = reorderWidth(info.R_INIT, K); // 正向候选含 reorder 多保留的尾部
+        std::vector<uint32_t> inDegree;
+        countInDegree(graph, inDegree);
+        buildStats.in_degree_before = inDegreeHistogram(inDegree);
+        buildStats.max_in_degree_before = *std::max_element(inDegree.begin(), inDegree.end());
+
+        // 给 hub 编号，统计指向每个 hub 的边在行中的位置，不是 hub 的节点为 EMPTY_ID
+        std::vector<node_t> hubOf(N, EMPTY_ID);
+        node_t hubs = 0;
+        for (uint64_t id_z = 0; id_z < N; id_z++)
+        {
+            if (inDegree[id_z] > H)
+            {
+                hubOf[id_z] = hubs++;
+            }
+        }
+        std::vector<uint32_t> slotCount((uint64_t)hubs * K, 0);
+#pragma omp parallel for schedule(dynamic, workloads)
+        for (uint64_t id_x = 0; id_x < N; id_x++)
+        {
+            for (uint64_t j = 0; j < K; j++)
+            {
+                node_t id_z = graph.at(id_x, j);
+                if (id_z != EMPTY_ID && hubOf[id_z] != EMPTY_ID)
+                {
+#pragma omp atomic
+                    slotCount[(uint64_t)hubOf[id_z] * K + j]++;
+                }
+            }
+        }
+
+        // 每个 hub 保留位置小于 keepSlots 的入边，保留后的入度不超过 H
+        std::vector<uint32_t> keepSlots(hubs);
+        std::vector<uint32_t> quota(N); // 还能接受的入边数
+#pragma omp parallel for schedule(static)
+        for (uint64_t id_z = 0; id_z < N; id_z++)
+        {
+            node_t h = hubOf[id_z];
+            if (h == EMPTY_ID)
+            {
+                quota[id_z] = H - inDegree[id_z];
+                continue;
+            }
+            uint64_t kept = 0;
+            uint32_t slot = 0;
+            while (slot < K && kept + slotCount[(uint64_t)h * K + slot] <= H)
+            {
+                kept += slotCount[(uint64_t)h * K + slot];
+                slot++;
+            }
+            keepSlots[h] = slot;
+            quota[id_z] = H - kept;
+        }
+
+        // 标出有边要去掉的行，只有这些行需要找替代
+        std::vector<uint8_t> touched(N, 0);
+#pragma omp parallel for schedule(dynamic, workloads)
+        for (uint64_t id_x = 0; id_x < N; id_x++)
+        {
+            const node_t *row = graph.edges(id_x);
+            for (uint64_t j = 0; j < K && !touched[id_x]; j++)
+            {
+                node_t h = row[j] == EMPTY_ID ? EMPTY_ID : hubOf[row[j]];
+                touched[id_x] = h != EMPTY_ID && j >= keepSlots[h];
+            }
+        }
+
+        // 余量是共享的，按行号顺序单线程分配，同一个节点不会被多行同时选中而超出上限
+        uint64_t replaced = 0;
+        uint64_t dropped = 0;
+        for (uint64_t id_x = 0; id_x < N; id_x++)
+        {
+            if (!touched[id_x])
+            {
+                continue;
+            }
+            node_t *row = graph.edges(id_x);
+            uint64_t i_s = 0; // 下一个待检查的正向候选
+            uint64_t i_r = 0; // 下一个待检查的反向候选
+            const uint64_t rSize = std::min<uint64_t>(edgeCount[id_x], K);
+            bool emptied = false;
+            for (uint64_t j = 0; j < K; j++)
+            {
+                node_t h = row[j] == EMPTY_ID ? EMPTY_ID : hubOf[row[j]];
+                if (h == EMPTY_ID || j < keepSlots[h])
+                {
+                    continue;
+                }
+                node_t candidate = EMPTY_ID;
+                while (candidate == EMPTY_ID && (i_s < width || i_r < rSize))
+                {
+                    node_t id_z = i_s < width ? reorderG.at(id_x, i_s++) : reversedG.at(id_x, i_r++);
+                    if (id_z != EMPTY_ID && id_z != id_x && quota[id_z] > 0 &&
+                        std::find(row, row + K, id_z) == row + K)
+                    {
+                        candidate = id_z;
+                    }
+                }
+                if (candidate == EMPTY_ID)
+                {
+                    emptied = true;
+                    dropped++;
+                }
+                else
+                {
+                    quota[candidate]--;
+                    replaced++;
+                }
+                row[j] = candidate;
+            }
+            if (emptied)
+            {
+                std::fill(std::remove(row, row + K, EMPTY_ID), row + K, EMPTY_ID);
+            }
+        }
+        buildStats.balanced_edges = replaced;
+        buildStats.dropped_edges = dropped;
+
+        countInDegree(graph, inDegree);
+        buildStats.in_degree_after = inDegreeHistogram(inDegree);
+        buildStats.max_in_degree_after = *std::max_element(inDegree.begin(), inDegree.end());
+    }
+
+    constexpr uint32_t REACHED = 1;     // 从入口点可达的节点的 label
+    constexpr int REPAIR_ROUNDS = 4;    // 换掉的边可能让别的节点走不到，修复后重新检查的轮数
+    constexpr size_t PARALLEL_FRONTIER = 1024; // frontier 小于此值时单线程展开
+
+    // 按层并行 BFS：从 frontier（已标为 mark）出发，只走 label 为 0 的节点并标为 mark。
+    // rows(id) 返回 id 的邻居（起始指针, 个数）。走到的节点集合与线程数无关。
+    // visited 非空时追加所有走到的节点，返回走到的节点数
+    template <typename Rows>
+    static uint64_t labelReachable(const Rows &rows, std::vector<node_t> frontier, std::vector<uint32_t> &label,
+                                   uint32_t mark, std::vector<node_t> *visited)
+    {
+        uint64_t count = 0;
+        std::vector<node_t> next;
+        while (!frontier.empty())
+        {
+            count += frontier.size();
+            if (visited != nullptr)
+            {
+                visited->insert(visited->end(), frontier.begin(), frontier.end());
+            }
+            next.clear();
+#pragma omp parallel if (frontier.size() >= PARALLEL_FRONTIER)
+            {
+                std::vector<node_t> local;
+#pragma omp for schedule(dynamic, workloads) nowait
+                for (size_t i = 0; i < frontier.size(); i++)
+                {
+                    std::pair<const node_t *, uint64_t> row = rows(frontier[i]);
+                    for (uint64_t j = 0; j < row.second; j++)
+                    {
+                        node_t id_z = row.first[j];
+                        if (id_z == EMPTY_ID)
+                        {
+                            continue;
+                        }
+                        uint32_t old;
+#pragma omp atomic read
+                        old = label[id_z];
+                        if (old != 0)
+                        {
+                            continue;
+                        }
+#pragma omp atomic capture
+                        {
+                            old = label[id_z];
+                            label[id_z] = mark;
+                        }
+                        if (old == 0)
+                        {
+                            local.push_back(id_z);
+                        }
+                    }
+                }
+#pragma omp critical
+                next.insert(next.end(), local.begin(), local.end());
+            }
+            frontier.swap(next);
+        }
+        return count;
+    }
+
+    // 以 g 的行作为 BFS 的邻居
+    static auto graphRows(const Graph<> &g)
+    {
+        return [&g](node_t id)
+        { return std::pair<const node_t *, uint64_t>(g.edges(id), g.K); };
+    }
+
+    // 转置图的 CSR：y 的入边来源为 srcs[rowStart[y], rowStart[y + 1])
+    struct TransposedGraph
+    {
+        std::vector<node_t> srcs;
+        std::vector<uint64_t> rowStart;
+
+        std::pair<const node_t *, uint64_t> operator()(node_t id) const
+        {
+            return {&srcs[rowStart[id]], rowStart[id + 1] - rowStart[id]};
+        }
+    };
+
+    // 转置与 reverse 阶段一样不用原子操作：边按 (目标块, 线程) 计数，各线程把 (x, y)
+    // 写到自己独占的区间，再由一个线程把每个块按 y 做计数排序，排好的 x 原地成为
+    // 转置图的 CSR，共 6 * N * K 字节
+    static TransposedGraph transposeGraph(const Graph<> &g)
+    {
+        const int64_t N = g.N;
+        const uint64_t K = g.K;
+        const int64_t T = omp_get_max_threads();
+        const Partition sources(N, T);
+        const int64_t blockSize = 1ll << REVERSE_BLOCK_BITS;
+        const int64_t blocks = (N + blockSize - 1) >> REVERSE_BLOCK_BITS;
+        std::vector<uint64_t> offsets(blocks * T + 1, 0); // 下标为 block * T + t
+
+#pragma omp parallel for schedule(static, 1)
+        for (int64_t t = 0; t < T; t++)
+        {
+            for (int64_t id_x = sources.begin(t); id_x < sources.end(t); id_x++)
+            {
+                for (uint64_t i = 0; i < K; ++i)
+                {
+                    node_t id_y = g.at(id_x, i);
+                    if (id_y != EMPTY_ID)
+                    {
+                        offsets[(id_y >> REVERSE_BLOCK_BITS) * T + t + 1]++;
+                    }
+                }
+            }
+        }
+        for (int64_t i = 0; i < blocks * T; i++)
+        {
+            offsets[i + 1] += offsets[i];
+        }
+
+        std::vector<node_t> srcs(offsets.back());
+        std::vector<uint16_t> dsts(offsets.back());
+#pragma omp parallel
+        {
+            std::vector<uint64_t> pos(blocks);
+#pragma omp for schedule(static, 1)
+            for (int64_t t = 0; t < T; t++)
+            {
+                for (int64_t block = 0; block < blocks; block++)
+                {
+                    pos[block] = offsets[block * T + t];
+                }
+                for (int64_t id_x = sources.begin(t); id_x < sources.end(t); id_x++)
+                {
+                    for (uint64_t i = 0; i < K; ++i)
+                    {
+                        node_t id_y = g.at(id_x, i);
+                        if (id_y != EMPTY_ID)
+                        {
+                            uint64_t p = pos[id_y >> REVERSE_BLOCK_BITS]++;
+                            srcs[p] = id_x;
+                            dsts[p] = id_y & (blockSize - 1);
+                        }
+                    }
+                }
+            }
+        }
+
+        // rowStart[y] 为 y 的入边在 srcs 中的起点
+        std::vector<uint64_t> rowStart(N + 1);
+        rowStart[N] = offsets.back();
+#pragma omp parallel
+        {
+            std::vector<node_t> blockSrcs;
+            std::vector<uint64_t> count(blockSize + 1);
+#pragma omp for schedule(dynamic, 1)
+            for (int64_t block = 0; block < blocks; block++)
+            {
+                const uint64_t first = offsets[block * T];
+                const uint64_t last = offsets[(block + 1) * T];
+                const int64_t idBegin = block * blockSize;
+                const int64_t n = std::min(N - idBegin, blockSize);
+                std::fill(count.begin(), count.end(), 0);
+                for (uint64_t p = first; p < last; p++)
+                {
+                    count[dsts[p] + 1]++;
+                }
+                for (int64_t y = 0; y < n; y++)
+                {
+                    count[y + 1] += count[y];
+                    rowStart[idBegin + y] = first + count[y];
+                }
+                blockSrcs.assign(&srcs[first], &srcs[first] + (last - first));
+                for (uint64_t p = first; p < last; p++)
+                {
+                    srcs[first + count[dsts[p]]++] = blockSrcs[p - first];
+                }
+            }
+        }
+        return {std::move(srcs), std::move(rowStart)};
+    }
+
+    // 能走到入口点的节点：从入口点在转置图上 BFS
+    static std::vector<uint32_t> reachesEntry(const Graph<> &g, const std::vector<node_t> &eps)
+    {
+        TransposedGraph transposed = transposeGraph(g);
+        std::vector<uint32_t> reaches(g.N, 0);
+        for (node_t ep : eps)
+        {
+            reaches[ep] = REACHED;
+        }
+        labelReachable(transposed, eps, reaches, REACHED, nullptr);
+        return reaches;
+    }
+
+    // 从入口点（graph.eps，为空时用节点 0）并行 BFS，按 id 顺序处理每个走不到的节点 u：
+    // 先标出从 u 能走到的其他不可达节点（一个分量），再找一个可达节点 w 加边 w -> u，
+    // w 优先取 u 的邻居，其次取分量中 id 最小、有可达邻居的节点的那个邻居，最后取入口点。
+    // 新边换掉 w 行中最靠后的、空位或入度不少于 2 的边，保证被换掉的节点仍有入边。
+    // 换边可能断开别的节点，所以修复后重新检查，最多 REPAIR_ROUNDS 轮。
+    // 所有选择只依赖节点 id，与线程数无关
+    void CagraBuilder::repairConnectivity()
+    {
+        const uint64_t N = graph.N;
+        const uint64_t K = graph.K;
+        std::vector<node_t> eps = graph.eps.empty() ? std::vector<node_t>{0} : graph.eps;
+        std::sort(eps.begin(), eps.end());
+        eps.erase(std::unique(eps.begin(), eps.end()), eps.end());
+
+        std::vector<uint32_t> inDegree;
+        countInDegree(graph, inDegree);
+        std::unordered_set<uint64_t> patchedSlots; // 补上的边所在的位置，不再被换掉
+        std::vector<uint32_t> label(N);
+        std::vector<node_t> component;
+        buildStats.repaired_edges = 0;
+
+        // 在 w 行中加一条指向 u 的边，成功返回 true
+        auto attach = [&](node_t w, node_t u)
+        {
+            node_t *row = graph.edges(w);
+            for (uint64_t j = K; j-- > 1;)
+            {
+                node_t id_z = row[j];
+                if (patchedSlots.count(w * K + j) || (id_z != EMPTY_ID && inDegree[id_z] < 2))
+                {
+                    continue;
+                }
+                if (id_z != EMPTY_ID)
+                {
+                    inDegree[id_z]--;
+                }
+                row[j] = u;
+                inDegree[u]++;
+                patchedSlots.insert(w * K + j);
+                return true;
+            }
+            return false;
+        };
+
+        for (int round = 0;; round++)
+        {
+            std::fill(label.begin(), label.end(), 0);
+            for (node_t ep : eps)
+            {
+                label[ep] = REACHED;
+            }
+            uint64_t unreachable = N - labelReachable(graphRows(graph), eps, label, REACHED, nullptr);
+            if (round == 0)
+            {
+                buildStats.unreachable_before = unreachable;
+            }
+            buildStats.unreachable_after = unreachable;
+            if (unreachable == 0 || round == REPAIR_ROUNDS)
+            {
+                break;
+            }
+
+            uint32_t mark = REACHED;
+            for (uint64_t u = 0; u < N; u++)
+            {
+                if (label[u] != 0)
+                {
+                    continue;
+                }
+                label[u] = ++mark;
+                component.clear();
+                labelReachable(graphRows(graph), {(node_t)u}, label, mark, &component);
+                // 此前的分量已接回，label 不为 0 且不是本分量的节点都可达
+                auto reached = [&](node_t id)
+                {
+                    return id != EMPTY_ID && label[id] != 0 && label[id] != mark;
+                };
+                bool attached = false;
+                for (uint64_t j = 0; j < K && !attached; j++)
+                {
+                    node_t w = graph.at(u, j);
+                    attached = reached(w) && attach(w, u);
+                }
+                std::sort(component.begin(), component.end());
+                for (size_t i = 0; i < component.size() && !attached; i++)
+                {
+                    for (uint64_t j = 0; j < K && !attached; j++)
+                    {
+                        node_t w = graph.at(component[i], j);
+                        attached = reached(w) && attach(w, u);
+                    }
+                }
+                for (size_t i = 0; i < eps.size() && !attached; i++)
+                {
+                    attached = attach(eps[i], u);
+                }
+                buildStats.repaired_edges += attached;
+            }
+        }
+
+        // 与入口点强连通：从入口点可达且能走回入口点
+        std::vector<uint32_t> reaches = reachesEntry(graph, eps);
+        uint64_t scc = 0;
+#pragma omp parallel for reduction(+ : scc)
+        for (uint64_t id_x = 0; id_x < N; id_x++)
+        {
+            scc += label[id_x] == REACHED && reaches[id_x] == REACHED;
+        }
+        buildStats.entry_scc_size = scc;
+    }
+
+    constexpr uint32_t UNREACHED_DIST = UINT32_MAX; // BFS 未走到的节点的跳数
+    constexpr uint64_t ENTRY_SAMPLES = 8;            // 估计离心率时 BFS 的样本节点数
+
+    // 按层并行 BFS，dist 为到 sources 的跳数。dist 中已有的值作为上界，只更新能变小的
+    // 节点，所以对多组 sources 依次调用得到的是到其中最近一个的跳数。结果与线程数无关
+    template <typename Rows>
+    static void bfsDistances(const Rows &rows, const std::vector<node_t> &sources, std::vector<uint32_t> &dist)
+    {
+        std::vector<node_t> frontier;
+        for (node_t s : sources)
+        {
+            if (dist[s] != 0)
+            {
+                dist[s] = 0;
+                frontier.push_back(s);
+            }
+        }
+        std::vector<node_t> next;
+        for (uint32_t level = 1; !frontier.empty(); level++)
+        {
+            next.clear();
+#pragma omp parallel if (frontier.size() >= PARALLEL_FRONTIER)
+            {
+                std::vector<node_t> local;
+#pragma omp for schedule(dynamic, workloads) nowait
+                for (size_t i = 0; i < frontier.size(); i++)
+                {
+                    std::pair<const node_t *, uint64_t> row = rows(frontier[i]);
+                    for (uint64_t j = 0; j < row.second; j++)
+                    {
+                        node_t id_z = row.first[j];
+                        if (id_z == EMPTY_ID)
+                        {
+                            continue;
+                        }
+                        uint32_t old;
+#pragma omp atomic read
+                        old = dist[id_z];
+                        if (old <= level)
+                        {
+                            continue;
+                        }
+                        // 本层只会写入 level，比 level 小的值在本层开始前就已确定
+#pragma omp atomic capture
+                        {
+                            old = dist[id_z];
+                            dist[id_z] = level;
+                        }
+                        if (old > level)
+                        {
+                            local.push_back(id_z);
+                        }
+                    }
+                }
+#pragma omp critical
+                next.insert(next.end(), local.begin(), local.end());
+            }
+            frontier.swap(next);
+        }
+    }
+
+    // 第一个入口点取图的中心：在转置图上从 ENTRY_SAMPLES 个均匀分布的样本 BFS，得到每个
+    // 节点走到各样本的跳数，取最大跳数（离心率的估计）最小的节点，相同时比较跳数之和，
+    // 再比较 id。其余入口点按最远优先选，每次取离已选入口点最远的节点（走不到的最远），
+    // 让任意节点到最近入口点的跳数尽量小。所有选择与线程数无关
+    void CagraBuilder::computeEntryPoints()
+    {
+        const uint64_t N = graph.N;
+        const uint64_t count = std::min<uint64_t>(info.ENTRY_POINTS, N);
+        graph.eps.clear();
+
+        node_t center = 0;
+        {
+            TransposedGraph transposed = transposeGraph(graph);
+            const uint64_t samples = std::min<uint64_t>(ENTRY_SAMPLES, N);
+            std::vector<uint32_t> maxDist(N, 0);
+            std::vector<uint64_t> sumDist(N, 0);
+            std::vector<uint32_t> dist(N);
+            for (uint64_t i = 0; i < samples; i++)
+            {
+                std::fill(dist.begin(), dist.end(), UNREACHED_DIST);
+                bfsDistances(transposed, {(node_t)(i * N / samples)}, dist);
+#pragma omp parallel for
+                for (uint64_t id_x = 0; id_x < N; id_x++)
+                {
+                    maxDist[id_x] = std::max(maxDist[id_x], dist[id_x]);
+                    sumDist[id_x] += dist[id_x];
+                }
+            }
+            for (uint64_t id_x = 1; id_x < N; id_x++)
+            {
+                if (std::make_pair(maxDist[id_x], sumDist[id_x]) < std::make_pair(maxDist[center], sumDist[center]))
+                {
+                    center = id_x;
+                }
+            }
+        }
+
+        std::vector<uint32_t> nearest(N, UNREACHED_DIST);
+        graph.eps.push_back(center);
+        bfsDistances(graphRows(graph), {center}, nearest);
+        while (graph.eps.size() < count)
+        {
+            node_t farthest = std::max_element(nearest.begin(), nearest.end()) - nearest.begin();
+            if (nearest[farthest] == 0)
+            {
+                break;
+            }
+            graph.eps.push_back(farthest);
+            bfsDistances(graphRows(graph), {farthest}, nearest);
+        }
+
+        buildStats.entry_points = graph.eps;
+        buildStats.entry_max_hops = 0;
+        buildStats.entry_unreachable = 0;
+        for (uint32_t d : nearest)
+        {
+            if (d == UNREACHED_DIST)
+            {
+                buildStats.entry_unreachable++;
+            }
+            else
+            {
+                buildStats.entry_max_hops = std::max(buildStats.entry_max_hops, d);
+            }
+        }
+    }
+
     CagraBuilder::~CagraBuilder() {}
 }
\ No newline at end of file
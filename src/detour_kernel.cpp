@@ -0,0 +1,433 @@
+#include <cpupg/detour_kernel.hpp>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPUPG_X86
+#endif
+
+namespace cpupg
+{
+    const char *simdLevelName(SimdLevel level)
+    {
+        switch (level)
+        {
+        case SimdLevel::SCALAR:
+            return "scalar";
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::AVX512:
+            return "avx512";
+        }
+        return "unknown";
+    }
+
+    SimdLevel detectSimdLevel()
+    {
+#ifdef CPUPG_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return SimdLevel::AVX512;
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return SimdLevel::AVX2;
+        }
+#endif
+        return SimdLevel::SCALAR;
+    }
+
+    // 模板参数 N 非 0 时行长为编译期常量 N，循环可完全展开；N 为 0 时使用运行期的 n
+    template <uint64_t N>
+    static void countDetoursScalar(const RankTable &neighbors_x, const uint32_t *row, uint64_t begin, uint64_t n_rt,
+                                   uint64_t dist_x_y, uint32_t *detours)
+    {
+        const uint64_t n = N ? N : n_rt;
+        for (uint64_t dist_y_z = begin; dist_y_z < n; dist_y_z++)
+        {
+            // 不存在时返回 -1，不会大于任何 rank
+            int64_t dist_x_z = neighbors_x.find(row[dist_y_z]);
+            if ((int64_t)std::max(dist_x_y, dist_y_z) < dist_x_z)
+            {
+                detours[dist_x_z]++;
+            }
+        }
+    }
+
+    template <uint64_t N>
+    static void countDetoursDistScalar(const RankTable &neighbors_x, const float *dists_x,
+                                       const uint32_t *row, const float *row_dists, uint64_t begin, uint64_t n_rt,
+                                       float dist_x_y, uint32_t *detours)
+    {
+        const uint64_t n = N ? N : n_rt;
+        for (uint64_t j = begin; j < n; j++)
+        {
+            int32_t dist_x_z = neighbors_x.find(row[j]);
+            if (dist_x_z >= 0 && std::max(dist_x_y, row_dists[j]) < dists_x[dist_x_z])
+            {
+                detours[dist_x_z]++;
+            }
+        }
+    }
+
+    static void countDetoursMergeScalar(const uint32_t *ids_x, const uint16_t *ranks_x, uint64_t i, uint64_t n_x,
+                                        const uint32_t *ids_y, const uint16_t *ranks_y, uint64_t j, uint64_t n_y,
+                                        uint32_t r_2hop, uint32_t dist_x_y, uint32_t *detours)
+    {
+        // 无分支归并：相等时只推进 y，使 y 中重复的 z 都能被统计
+        while (i < n_x && j < n_y)
+        {
+            uint32_t a = ids_x[i];
+            uint32_t b = ids_y[j];
+            uint32_t dist_x_z = ranks_x[i];
+            uint32_t dist_y_z = ranks_y[j];
+            detours[dist_x_z] += (a == b) & (std::max(dist_x_y, dist_y_z) < dist_x_z) & (dist_y_z < r_2hop);
+            i += a < b;
+            j += b <= a;
+        }
+    }
+
+#ifdef CPUPG_X86
+    // 一次查 8 个 z 的 rank：gather 槽位做线性探测，直到所有 lane 命中或遇到空槽，未命中的 lane 为 -1
+    __attribute__((target("avx2"), always_inline)) static inline __m256i lookupRanksAvx2(const RankTable &neighbors_x, __m256i z)
+    {
+        const int *keys = (const int *)neighbors_x.slotKeys();
+        const int *ranks = neighbors_x.slotRanks();
+        const int *stamps = (const int *)neighbors_x.slotStamps();
+        const __m256i vmask = _mm256_set1_epi32(neighbors_x.slotMask());
+        const __m256i vepoch = _mm256_set1_epi32(neighbors_x.currentEpoch());
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i slot = _mm256_srl_epi32(_mm256_mullo_epi32(z, _mm256_set1_epi32((int)RankTable::HASH_MUL)),
+                                        _mm_cvtsi32_si128(neighbors_x.hashShift()));
+        __m256i rank = _mm256_set1_epi32(-1);
+        __m256i pending = _mm256_set1_epi32(-1);
+        do
+        {
+            __m256i st = _mm256_mask_i32gather_epi32(zero, stamps, slot, pending, 4);
+            __m256i key = _mm256_mask_i32gather_epi32(zero, keys, slot, pending, 4);
+            __m256i live = _mm256_and_si256(pending, _mm256_cmpeq_epi32(st, vepoch));
+            __m256i hit = _mm256_and_si256(live, _mm256_cmpeq_epi32(key, z));
+            rank = _mm256_mask_i32gather_epi32(rank, ranks, slot, hit, 4);
+            pending = _mm256_andnot_si256(hit, live);
+            slot = _mm256_and_si256(_mm256_add_epi32(slot, one), vmask);
+        } while (!_mm256_testz_si256(pending, pending));
+        return rank;
+    }
+
+    // 对 detourable 为真的 lane 累加 detours[rank]
+    __attribute__((target("avx2"), always_inline)) static inline void addDetoursAvx2(__m256i rank, __m256i detourable, uint32_t *detours)
+    {
+        alignas(32) int32_t buf[8];
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(detourable));
+        _mm256_store_si256((__m256i *)buf, rank);
+        while (bits)
+        {
+            detours[buf[__builtin_ctz(bits)]]++;
+            bits &= bits - 1;
+        }
+    }
+
+    template <uint64_t N>
+    __attribute__((target("avx2"))) static void countDetoursAvx2(const RankTable &neighbors_x, const uint32_t *row, uint64_t n_rt,
+                                                                 uint64_t dist_x_y, uint32_t *detours)
+    {
+        const uint64_t n = N ? N : n_rt;
+        const __m256i vdxy = _mm256_set1_epi32(dist_x_y);
+        __m256i vdyz = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        uint64_t j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            __m256i rank = lookupRanksAvx2(neighbors_x, _mm256_loadu_si256((const __m256i *)(row + j)));
+            __m256i bound = _mm256_max_epu32(vdxy, vdyz);
+            addDetoursAvx2(rank, _mm256_cmpgt_epi32(rank, bound), detours);
+            vdyz = _mm256_add_epi32(vdyz, _mm256_set1_epi32(8));
+        }
+        // N 是向量宽度的整数倍时主循环已处理完整行，不再生成 scalar 尾部
+        if constexpr (N == 0 || N % 8 != 0)
+        {
+            countDetoursScalar<N>(neighbors_x, row, j, n, dist_x_y, detours);
+        }
+    }
+
+    template <uint64_t N>
+    __attribute__((target("avx2"))) static void countDetoursDistAvx2(const RankTable &neighbors_x, const float *dists_x,
+                                                                     const uint32_t *row, const float *row_dists, uint64_t n_rt,
+                                                                     float dist_x_y, uint32_t *detours)
+    {
+        const uint64_t n = N ? N : n_rt;
+        const __m256 vdxy = _mm256_set1_ps(dist_x_y);
+        uint64_t j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            __m256i rank = lookupRanksAvx2(neighbors_x, _mm256_loadu_si256((const __m256i *)(row + j)));
+            __m256i hit = _mm256_cmpgt_epi32(rank, _mm256_set1_epi32(-1));
+            __m256 dxz = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), dists_x, rank, _mm256_castsi256_ps(hit), 4);
+            __m256 bound = _mm256_max_ps(vdxy, _mm256_loadu_ps(row_dists + j));
+            __m256i less = _mm256_castps_si256(_mm256_cmp_ps(bound, dxz, _CMP_LT_OQ));
+            addDetoursAvx2(rank, _mm256_and_si256(hit, less), detours);
+        }
+        if constexpr (N == 0 || N % 8 != 0)
+        {
+            countDetoursDistScalar<N>(neighbors_x, dists_x, row, row_dists, j, n, dist_x_y, detours);
+        }
+    }
+
+    // 一次查 16 个 z 的 rank，未命中的 lane 为 -1
+    __attribute__((target("avx512f"), always_inline)) static inline __m512i lookupRanksAvx512(const RankTable &neighbors_x, __m512i z)
+    {
+        const int *keys = (const int *)neighbors_x.slotKeys();
+        const int *ranks = neighbors_x.slotRanks();
+        const int *stamps = (const int *)neighbors_x.slotStamps();
+        const __m512i vmask = _mm512_set1_epi32(neighbors_x.slotMask());
+        const __m512i vepoch = _mm512_set1_epi32(neighbors_x.currentEpoch());
+        const __m512i one = _mm512_set1_epi32(1);
+        const __m512i zero = _mm512_setzero_si512();
+        // 不带掩码的 AVX-512 intrinsic 在 GCC 12 中以未初始化的向量作源，会误报 -Wuninitialized，
+        // 这里都用全 1 掩码的 maskz 形式，编译结果相同
+        __m512i slot = _mm512_maskz_srl_epi32(0xFFFF, _mm512_mullo_epi32(z, _mm512_set1_epi32((int)RankTable::HASH_MUL)),
+                                              _mm_cvtsi32_si128(neighbors_x.hashShift()));
+        __m512i rank = _mm512_set1_epi32(-1);
+        __mmask16 pending = 0xFFFF;
+        do
+        {
+            __m512i st = _mm512_mask_i32gather_epi32(zero, pending, slot, stamps, 4);
+            __m512i key = _mm512_mask_i32gather_epi32(zero, pending, slot, keys, 4);
+            __mmask16 live = _mm512_mask_cmpeq_epi32_mask(pending, st, vepoch);
+            __mmask16 hit = _mm512_mask_cmpeq_epi32_mask(live, key, z);
+            rank = _mm512_mask_i32gather_epi32(rank, hit, slot, ranks, 4);
+            pending = live & ~hit;
+            slot = _mm512_and_si512(_mm512_add_epi32(slot, one), vmask);
+        } while (pending);
+        return rank;
+    }
+
+    // 命中的 rank 压缩写出后再逐个累加，避免同一块内重复 z 的写冲突
+    __attribute__((target("avx512f"), always_inline)) static inline void addDetoursAvx512(__m512i rank, __mmask16 detourable, uint32_t *detours)
+    {
+        alignas(64) int32_t buf[16];
+        _mm512_mask_compressstoreu_epi32(buf, detourable, rank);
+        int cnt = __builtin_popcount(detourable);
+        for (int i = 0; i < cnt; i++)
+        {
+            detours[buf[i]]++;
+        }
+    }
+
+    template <uint64_t N>
+    __attribute__((target("avx512f"))) static void countDetoursAvx512(const RankTable &neighbors_x, const uint32_t *row, uint64_t n_rt,
+                                                                      uint64_t dist_x_y, uint32_t *detours)
+    {
+        const uint64_t n = N ? N : n_rt;
+        const __m512i vdxy = _mm512_set1_epi32(dist_x_y);
+        __m512i vdyz = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        uint64_t j = 0;
+        for (; j + 16 <= n; j += 16)
+        {
+            __m512i rank = lookupRanksAvx512(neighbors_x, _mm512_loadu_si512(row + j));
+            __m512i bound = _mm512_maskz_max_epu32(0xFFFF, vdxy, vdyz);
+            addDetoursAvx512(rank, _mm512_cmpgt_epi32_mask(rank, bound), detours);
+            vdyz = _mm512_add_epi32(vdyz, _mm512_set1_epi32(16));
+        }
+        if constexpr (N == 0 || N % 16 != 0)
+        {
+            countDetoursScalar<N>(neighbors_x, row, j, n, dist_x_y, detours);
+        }
+    }
+
+    template <uint64_t N>
+    __attribute__((target("avx512f"))) static void countDetoursDistAvx512(const RankTable &neighbors_x, const float *dists_x,
+                                                                          const uint32_t *row, const float *row_dists, uint64_t n_rt,
+                                                                          float dist_x_y, uint32_t *detours)
+    {
+        const uint64_t n = N ? N : n_rt;
+        const __m512 vdxy = _mm512_set1_ps(dist_x_y);
+        uint64_t j = 0;
+        for (; j + 16 <= n; j += 16)
+        {
+            __m512i rank = lookupRanksAvx512(neighbors_x, _mm512_loadu_si512(row + j));
+            __mmask16 hit = _mm512_cmpgt_epi32_mask(rank, _mm512_set1_epi32(-1));
+            __m512 dxz = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), hit, rank, dists_x, 4);
+            __m512 bound = _mm512_maskz_max_ps(0xFFFF, vdxy, _mm512_loadu_ps(row_dists + j));
+            addDetoursAvx512(rank, _mm512_mask_cmp_ps_mask(hit, bound, dxz, _CMP_LT_OQ), detours);
+        }
+        if constexpr (N == 0 || N % 16 != 0)
+        {
+            countDetoursDistScalar<N>(neighbors_x, dists_x, row, row_dists, j, n, dist_x_y, detours);
+        }
+    }
+
+    // 8x8 分块求交：x 块内 id 不重复，每个 y 元素最多命中一个 lane
+    __attribute__((target("avx2"))) static void countDetoursMergeAvx2(const uint32_t *ids_x, const uint16_t *ranks_x, uint64_t n_x,
+                                                                      const uint32_t *ids_y, const uint16_t *ranks_y, uint64_t n_y,
+                                                                      uint32_t r_2hop, uint32_t dist_x_y, uint32_t *detours)
+    {
+        uint64_t i = 0, j = 0;
+        while (i + 8 <= n_x && j + 8 <= n_y)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(ids_x + i));
+            for (uint64_t k = j; k < j + 8; k++)
+            {
+                __m256i b = _mm256_set1_epi32(ids_y[k]);
+                int bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)));
+                if (bits)
+                {
+                    uint32_t dist_x_z = ranks_x[i + __builtin_ctz(bits)];
+                    uint32_t dist_y_z = ranks_y[k];
+                    detours[dist_x_z] += (std::max(dist_x_y, dist_y_z) < dist_x_z) & (dist_y_z < r_2hop);
+                }
+            }
+            uint32_t a_max = ids_x[i + 7];
+            uint32_t b_max = ids_y[j + 7];
+            i += (a_max < b_max) * 8;
+            j += (b_max <= a_max) * 8;
+        }
+        countDetoursMergeScalar(ids_x, ranks_x, i, n_x, ids_y, ranks_y, j, n_y, r_2hop, dist_x_y, detours);
+    }
+
+    __attribute__((target("avx512f"))) static void countDetoursMergeAvx512(const uint32_t *ids_x, const uint16_t *ranks_x, uint64_t n_x,
+                                                                           const uint32_t *ids_y, const uint16_t *ranks_y, uint64_t n_y,
+                                                                           uint32_t r_2hop, uint32_t dist_x_y, uint32_t *detours)
+    {
+        uint64_t i = 0, j = 0;
+        while (i + 16 <= n_x && j + 16 <= n_y)
+        {
+            __m512i a = _mm512_loadu_si512(ids_x + i);
+            for (uint64_t k = j; k < j + 16; k++)
+            {
+                __mmask16 bits = _mm512_cmpeq_epi32_mask(a, _mm512_set1_epi32(ids_y[k]));
+                if (bits)
+                {
+                    uint32_t dist_x_z = ranks_x[i + __builtin_ctz(bits)];
+                    uint32_t dist_y_z = ranks_y[k];
+                    detours[dist_x_z] += (std::max(dist_x_y, dist_y_z) < dist_x_z) & (dist_y_z < r_2hop);
+                }
+            }
+            uint32_t a_max = ids_x[i + 15];
+            uint32_t b_max = ids_y[j + 15];
+            i += (a_max < b_max) * 16;
+            j += (b_max <= a_max) * 16;
+        }
+        countDetoursMergeScalar(ids_x, ranks_x, i, n_x, ids_y, ranks_y, j, n_y, r_2hop, dist_x_y, detours);
+    }
+#endif
+
+    template <uint64_t N>
+    static void countDetoursRow(const RankTable &neighbors_x, const uint32_t *row, uint64_t n,
+                                uint64_t dist_x_y, uint32_t *detours)
+    {
+        countDetoursScalar<N>(neighbors_x, row, 0, n, dist_x_y, detours);
+    }
+
+    template <uint64_t N>
+    static void countDetoursDistRow(const RankTable &neighbors_x, const float *dists_x,
+                                    const uint32_t *row, const float *row_dists, uint64_t n,
+                                    float dist_x_y, uint32_t *detours)
+    {
+        countDetoursDistScalar<N>(neighbors_x, dists_x, row, row_dists, 0, n, dist_x_y, detours);
+    }
+
+    template <uint64_t N>
+    static DetourKernel detourKernelFor(SimdLevel level)
+    {
+        switch (level)
+        {
+#ifdef CPUPG_X86
+        case SimdLevel::AVX512:
+            return countDetoursAvx512<N>;
+        case SimdLevel::AVX2:
+            return countDetoursAvx2<N>;
+#endif
+        default:
+            return countDetoursRow<N>;
+        }
+    }
+
+    template <uint64_t N>
+    static DetourDistKernel detourDistKernelFor(SimdLevel level)
+    {
+        switch (level)
+        {
+#ifdef CPUPG_X86
+        case SimdLevel::AVX512:
+            return countDetoursDistAvx512<N>;
+        case SimdLevel::AVX2:
+            return countDetoursDistAvx2<N>;
+#endif
+        default:
+            return countDetoursDistRow<N>;
+        }
+    }
+
+    DetourKernel selectDetourKernel(SimdLevel level, uint64_t n, bool fixed)
+    {
+        if (fixed)
+        {
+            switch (n)
+            {
+            case 64:
+                return detourKernelFor<64>(level);
+            case 96:
+                return detourKernelFor<96>(level);
+            case 128:
+                return detourKernelFor<128>(level);
+            case 256:
+                return detourKernelFor<256>(level);
+            }
+        }
+        return detourKernelFor<0>(level);
+    }
+
+    DetourDistKernel selectDetourDistKernel(SimdLevel level, uint64_t n, bool fixed)
+    {
+        if (fixed)
+        {
+            switch (n)
+            {
+            case 64:
+                return detourDistKernelFor<64>(level);
+            case 96:
+                return detourDistKernelFor<96>(level);
+            case 128:
+                return detourDistKernelFor<128>(level);
+            case 256:
+                return detourDistKernelFor<256>(level);
+            }
+        }
+        return detourDistKernelFor<0>(level);
+    }
+
+    void countDetours(const RankTable &neighbors_x, const uint32_t *row, uint64_t n,
+                      uint64_t dist_x_y, uint32_t *detours, SimdLevel level)
+    {
+        selectDetourKernel(level, n, false)(neighbors_x, row, n, dist_x_y, detours);
+    }
+
+    void countDetoursDist(const RankTable &neighbors_x, const float *dists_x,
+                          const uint32_t *row, const float *row_dists, uint64_t n,
+                          float dist_x_y, uint32_t *detours, SimdLevel level)
+    {
+        selectDetourDistKernel(level, n, false)(neighbors_x, dists_x, row, row_dists, n, dist_x_y, detours);
+    }
+
+    void countDetoursMerge(const uint32_t *ids_x, const uint16_t *ranks_x, uint64_t n_x,
+                           const uint32_t *ids_y, const uint16_t *ranks_y, uint64_t n_y,
+                           uint64_t r_2hop, uint64_t dist_x_y, uint32_t *detours, SimdLevel level)
+    {
+        switch (level)
+        {
+#ifdef CPUPG_X86
+        case SimdLevel::AVX512:
+            countDetoursMergeAvx512(ids_x, ranks_x, n_x, ids_y, ranks_y, n_y, r_2hop, dist_x_y, detours);
+            return;
+        case SimdLevel::AVX2:
+            countDetoursMergeAvx2(ids_x, ranks_x, n_x, ids_y, ranks_y, n_y, r_2hop, dist_x_y, detours);
+            return;
+#endif
+        default:
+            countDetoursMergeScalar(ids_x, ranks_x, 0, n_x, ids_y, ranks_y, 0, n_y, r_2hop, dist_x_y, detours);
+            return;
+        }
+    }
+}
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <omp.h>
+#include <cpupg/builder_cagra.hpp>
+#include <cpupg/parameters.hpp>
+
+// 在同一个 KNNG 上依次用不同的 reorder 实现建图，比较各阶段耗时和结果是否一致
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <json_path>" << std::endl;
+        exit(-1);
+    }
+
+    cpupg::CagraConfig config = cpupg::loadCagraConfig(argv[1]);
+
+    cpupg::Graph knnG = cpupg::loadCagraKnng(config);
+    std::cout << "Loaded!" << std::endl;
+
+    cpupg::GraphInfo info = cpupg::makeGraphInfo(config, knnG);
+
+    // 任何一次比较有不同的行时以非 0 退出
+    bool mismatch = false;
+    auto finish = [&mismatch]()
+    {
+        if (mismatch)
+        {
+            std::cerr << "Error: some builds differ from the reference, see the row counts above." << std::endl;
+            return 1;
+        }
+        return 0;
+    };
+
+    // 各 reorder 实现按配置运行，另外对默认实现比较两种调度方式、是否使用定长 kernel、
+    // reverse 阶段是否经缓冲区分区写出以及是否把 merge 并入 reverse
+    struct Run
+    {
+        cpupg::ReorderEngine engine;
+        cpupg::ReorderSchedule schedule;
+        bool fixedDegree;
+        bool bufferedScatter;
+        bool fusedMerge;
+    };
+    std::vector<Run> runs = {
+        {cpupg::ReorderEngine::HASH_MAP, config.reorder_schedule, config.fixed_degree, config.buffered_scatter, config.fused_merge},
+        {cpupg::ReorderEngine::RANK_TABLE, config.reorder_schedule, config.fixed_degree, config.buffered_scatter, config.fused_merge},
+        {cpupg::ReorderEngine::SORTED_MERGE, config.reorder_schedule, config.fixed_degree, config.buffered_scatter, config.fused_merge},
+        {cpupg::ReorderEngine::SIMD, cpupg::ReorderSchedule::INDEX, false, true, true},
+        {cpupg::ReorderEngine::SIMD, cpupg::ReorderSchedule::INDEX, true, false, true},
+        {cpupg::ReorderEngine::SIMD, cpupg::ReorderSchedule::INDEX, true, true, false},
+        {cpupg::ReorderEngine::SIMD, cpupg::ReorderSchedule::INDEX, true, true, true},
+        {cpupg::ReorderEngine::SIMD, cpupg::ReorderSchedule::NN_CLUSTER, true, true, true},
+    };
+
+    cpupg::Graph<> reference;
+    for (const Run &run : runs)
+    {
+        if (run.engine == cpupg::ReorderEngine::SORTED_MERGE && info.DETOUR_METRIC == cpupg::DetourMetric::DISTANCE)
+        {
+            continue;
+        }
+        info.REORDER_ENGINE = run.engine;
+        info.REORDER_SCHEDULE = run.schedule;
+        info.FIXED_DEGREE = run.fixedDegree;
+        info.BUFFERED_SCATTER = run.bufferedScatter;
+        info.FUSED_MERGE = run.fusedMerge;
+        std::cout << "[" << cpupg::reorderEngineName(run.engine) << ", " << cpupg::reorderScheduleName(run.schedule)
+                  << (run.fixedDegree ? ", fixed degree" : ", generic")
+                  << (run.bufferedScatter ? ", buffered scatter" : ", direct scatter")
+                  << (run.fusedMerge ? ", fused merge" : ", separate merge") << "]" << std::endl;
+        cpupg::CagraBuilder builder(info);
+        cpupg::Graph<> cagraG = builder.build(cpupg::Graph<>(knnG)); // build 会接管输入，传入一份拷贝
+        builder.stats().print();
+
+        if (reference.data == nullptr)
+        {
+            reference = std::move(cagraG);
+            continue;
+        }
+        size_t diffRows = 0;
+        for (uint64_t i = 0; i < cagraG.N; i++)
+        {
+            if (!std::equal(cagraG.edges(i), cagraG.edges(i) + cagraG.K, reference.edges(i)))
+            {
+                diffRows++;
+            }
+        }
+        std::cout << "Rows differing from the first run: " << diffRows << std::endl;
+        mismatch = mismatch || diffRows != 0;
+    }
+
+    // 建图结果与线程数无关：用不同的线程数重建，与第一次的结果逐行比较
+    info.REORDER_ENGINE = config.reorder_engine;
+    info.REORDER_SCHEDULE = config.reorder_schedule;
+    info.FIXED_DEGREE = config.fixed_degree;
+    info.BUFFERED_SCATTER = config.buffered_scatter;
+    info.FUSED_MERGE = config.fused_merge;
+    const int maxThreads = omp_get_max_threads();
+    for (int threads : {1, 2, 7, 16})
+    {
+        omp_set_num_threads(threads);
+        cpupg::CagraBuilder builder(info);
+        cpupg::Graph<> cagraG = builder.build(cpupg::Graph<>(knnG));
+        const cpupg::BuildStats &stats = builder.stats();
+        size_t diffRows = 0;
+        for (uint64_t i = 0; i < cagraG.N; i++)
+        {
+            if (!std::equal(cagraG.edges(i), cagraG.edges(i) + cagraG.K, reference.edges(i)))
+            {
+                diffRows++;
+            }
+        }
+        std::cout << "[" << threads << " threads] build time: " << stats.reorder_time + stats.reverse_time + stats.merge_time
+                  << " s, rows differing from the first run: " << diffRows << std::endl;
+        mismatch = mismatch || diffRows != 0;
+    }
+    omp_set_num_threads(maxThreads);
+
+    if (config.r_init_sweep.empty() && config.r_sweep.empty())
+    {
+        return finish();
+    }
+
+    // 一次 reorder 输出所有 (R_INIT, R)，与逐个单独建图比较耗时和结果
+    info.REORDER_ENGINE = config.reorder_engine;
+    info.REORDER_SCHEDULE = config.reorder_schedule;
+    info.FIXED_DEGREE = config.fixed_degree;
+    info.BUFFERED_SCATTER = config.buffered_scatter;
+    info.FUSED_MERGE = config.fused_merge;
+    std::cout << "[R_INIT / R sweep, single pass]" << std::endl;
+    std::vector<std::pair<uint64_t, uint64_t>> params;
+    std::vector<cpupg::Graph<>> sweepG;
+    {
+        cpupg::CagraBuilder builder(info);
+        builder.buildSweep(cpupg::Graph<>(knnG), cpupg::rInitValues(config), cpupg::rValues(config),
+                           [&](uint64_t rInit, uint64_t r, const cpupg::Graph<> &cagraG)
+                           {
+            params.emplace_back(rInit, r);
+            sweepG.emplace_back(cagraG); });
+        builder.stats().print();
+    }
+
+    double separateTime = 0;
+    for (uint64_t b = 0; b < params.size(); b++)
+    {
+        info.R_INIT = params[b].first;
+        info.R = params[b].second;
+        info.R_2HOP = config.r_2hop;
+        cpupg::CagraBuilder builder(info);
+        cpupg::Graph<> cagraG = builder.build(cpupg::Graph<>(knnG));
+        const cpupg::BuildStats &stats = builder.stats();
+        separateTime += stats.reorder_time + stats.reverse_time + stats.merge_time;
+        size_t diffRows = 0;
+        for (uint64_t i = 0; i < cagraG.N; i++)
+        {
+            if (!std::equal(cagraG.edges(i), cagraG.edges(i) + cagraG.K, sweepG[b].edges(i)))
+            {
+                diffRows++;
+            }
+        }
+        std::cout << "R_INIT " << params[b].first << ", R " << params[b].second
+                  << ": rows differing from separate build: " << diffRows << std::endl;
+        mismatch = mismatch || diffRows != 0;
+    }
+    std::cout << "Separate builds total time: " << separateTime << " s" << std::endl;
+    return finish();
+}
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cpupg/builder_cagra.hpp>
+#include <cpupg/parameters.hpp>
+
+// 用不同的 merge 策略建图，在同一组查询上做 beam search，比较 recall、跳数和延迟
+constexpr uint64_t TOPK = 10;
+
+// 读取 fbin 格式的向量：num、dim 两个 4 字节整数，之后是 num * dim 个 float
+static std::vector<float> loadFbin(const std::string &path, uint32_t &num, uint32_t &dim)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp || fread(&num, 4, 1, fp) != 1 || fread(&dim, 4, 1, fp) != 1)
+    {
+        std::cerr << "Error: Cannot read " << path << std::endl;
+        exit(1);
+    }
+    std::vector<float> data((uint64_t)num * dim);
+    if (fread(data.data(), sizeof(float), data.size(), fp) != data.size())
+    {
+        std::cerr << "Error: " << path << " is truncated" << std::endl;
+        exit(1);
+    }
+    fclose(fp);
+    return data;
+}
+
+static float l2(const float *a, const float *b, uint32_t dim)
+{
+    float sum = 0;
+    for (uint32_t d = 0; d < dim; d++)
+    {
+        float diff = a[d] - b[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+struct SearchStats
+{
+    double recall = 0;
+    double hops = 0;      // 平均展开的节点数
+    double distances = 0; // 平均距离计算次数
+    double latency = 0;   // 平均每个查询的耗时（微秒）
+};
+
+// 在 CSR 图上做 beam search：从图的入口点（没有时为节点 0）出发，候选池保留最近的 L 个点，每次展开
+// 最近的未展开点，没有可展开的点时结束，取池中前 TOPK 个作为结果。self[q] 不为 EMPTY_ID 时
+// 查询取自该原始向量，结果中跳过它
+static SearchStats search(const cpupg::CsrGraph &g, const std::vector<float> &base, const std::vector<float> &queries,
+                          uint32_t dim, const std::vector<cpupg::node_t> &truth, const std::vector<cpupg::node_t> &self,
+                          uint64_t L)
+{
+    struct Candidate
+    {
+        float dist;
+        cpupg::node_t id;
+        bool expanded;
+    };
+    const uint64_t Q = queries.size() / dim;
+    std::vector<uint32_t> visited(g.N, 0);
+    std::vector<Candidate> pool;
+    const std::vector<cpupg::node_t> eps = g.eps.empty() ? std::vector<cpupg::node_t>{0} : g.eps;
+    SearchStats stats;
+    for (uint64_t q = 0; q < Q; q++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        const float *query = &queries[q * dim];
+        const uint32_t stamp = q + 1;
+        pool.clear();
+        for (cpupg::node_t ep : eps)
+        {
+            if (visited[ep] != stamp)
+            {
+                visited[ep] = stamp;
+                pool.push_back({l2(query, &base[(uint64_t)ep * dim], dim), ep, false});
+            }
+        }
+        std::sort(pool.begin(), pool.end(), [](const Candidate &a, const Candidate &b)
+                  { return a.dist < b.dist; });
+        uint64_t hops = 0;
+        uint64_t distances = pool.size();
+        while (true)
+        {
+            auto next = std::find_if(pool.begin(), pool.end(), [](const Candidate &c)
+                                     { return !c.expanded; });
+            if (next == pool.end())
+            {
+                break;
+            }
+            next->expanded = true;
+            hops++;
+            const cpupg::node_t *row = g.edges(next->id);
+            const uint64_t degree = g.degree(next->id);
+            for (uint64_t j = 0; j < degree; j++)
+            {
+                cpupg::node_t id = row[j];
+                if (visited[id] == stamp)
+                {
+                    continue;
+                }
+                visited[id] = stamp;
+                distances++;
+                float dist = l2(query, &base[(uint64_t)id * dim], dim);
+                if (pool.size() >= L && dist >= pool.back().dist)
+                {
+                    continue;
+                }
+                auto pos = std::upper_bound(pool.begin(), pool.end(), dist, [](float d, const Candidate &c)
+                                            { return d < c.dist; });
+                pool.insert(pos, {dist, id, false});
+                if (pool.size() > L)
+                {
+                    pool.pop_back();
+                }
+            }
+        }
+        stats.latency += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+
+        uint64_t hit = 0;
+        uint64_t taken = 0;
+        for (uint64_t i = 0; i < pool.size() && taken < TOPK; i++)
+        {
+            if (pool[i].id == self[q])
+            {
+                continue;
+            }
+            hit += std::count(&truth[q * TOPK], &truth[q * TOPK] + TOPK, pool[i].id);
+            taken++;
+        }
+        stats.recall += (double)hit / TOPK;
+        stats.hops += hops;
+        stats.distances += distances;
+    }
+    stats.recall /= Q;
+    stats.hops /= Q;
+    stats.distances /= Q;
+    stats.latency /= Q;
+    return stats;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <json_path>" << std::endl;
+        exit(-1);
+    }
+
+    cpupg::CagraConfig config = cpupg::loadCagraConfig(argv[1]);
+    if (config.base_path.empty())
+    {
+        std::cerr << "Error: bench_merge requires BASE_PATH." << std::endl;
+        exit(-1);
+    }
+
+    cpupg::Graph knnG = cpupg::loadCagraKnng(config);
+
+    uint32_t num = 0;
+    uint32_t dim = 0;
+    std::cout << "Loading base vectors from " << config.base_path << std::endl;
+    std::vector<float> base = loadFbin(config.base_path, num, dim);
+    if (num != knnG.N)
+    {
+        std::cerr << "Error: BASE_PATH has " << num << " vectors, KNNG has " << knnG.N << " nodes." << std::endl;
+        exit(-1);
+    }
+    // 没有 QUERY_PATH 时均匀取 1000 个原始向量作查询，它们自己不计入真值和结果，
+    // 否则距离为 0 的自身总能找到，recall 接近 1，区分不出各策略
+    std::vector<float> queries;
+    std::vector<cpupg::node_t> self;
+    if (!config.query_path.empty())
+    {
+        uint32_t queryNum = 0;
+        uint32_t queryDim = 0;
+        std::cout << "Loading queries from " << config.query_path << std::endl;
+        queries = loadFbin(config.query_path, queryNum, queryDim);
+        if (queryDim != dim)
+        {
+            std::cerr << "Error: QUERY_PATH has dimension " << queryDim << ", BASE_PATH has " << dim << "." << std::endl;
+            exit(-1);
+        }
+    }
+    else
+    {
+        const uint64_t step = std::max<uint64_t>(knnG.N / 1000, 1);
+        for (uint64_t i = 0; i < knnG.N; i += step)
+        {
+            queries.insert(queries.end(), &base[i * dim], &base[i * dim] + dim);
+            self.push_back(i);
+        }
+    }
+    const uint64_t Q = queries.size() / dim;
+    self.resize(Q, cpupg::EMPTY_ID);
+    std::cout << "Loaded! " << Q << " queries" << std::endl;
+
+    // 暴力计算每个查询的前 TOPK 个最近邻
+    std::vector<cpupg::node_t> truth(Q * TOPK);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (uint64_t q = 0; q < Q; q++)
+    {
+        std::vector<std::pair<float, cpupg::node_t>> all(knnG.N);
+        for (uint64_t i = 0; i < knnG.N; i++)
+        {
+            float dist = i == self[q] ? std::numeric_limits<float>::max() : l2(&queries[q * dim], &base[(uint64_t)i * dim], dim);
+            all[i] = {dist, i};
+        }
+        std::partial_sort(all.begin(), all.begin() + TOPK, all.end());
+        for (uint64_t i = 0; i < TOPK; i++)
+        {
+            truth[q * TOPK + i] = all[i].second;
+        }
+    }
+
+    cpupg::GraphInfo info = cpupg::makeGraphInfo(config, knnG);
+
+    // 配置中的策略放在第一个，之后是固定的对照组
+    struct Policy
+    {
+        cpupg::MergePolicy policy;
+        double reverseRatio;
+    };
+    std::vector<Policy> policies = {
+        {config.merge_policy, config.reverse_ratio},
+        {cpupg::MergePolicy::FORWARD_FIRST, 0.25},
+        {cpupg::MergePolicy::FORWARD_FIRST, 0.5},
+        {cpupg::MergePolicy::FORWARD_FIRST, 0.75},
+        {cpupg::MergePolicy::INTERLEAVE, 0.5},
+        {cpupg::MergePolicy::RECIPROCAL_FIRST, 0.5},
+    };
+    for (const Policy &policy : policies)
+    {
+        info.MERGE_POLICY = policy.policy;
+        info.REVERSE_RATIO = policy.reverseRatio;
+        std::cout << "[" << cpupg::mergePolicyName(policy.policy) << ", reverse ratio " << policy.reverseRatio << "]" << std::endl;
+        cpupg::CagraBuilder builder(info);
+        cpupg::Graph<> cagraG = builder.build(cpupg::Graph<>(knnG)); // build 会接管输入，传入一份拷贝
+        builder.stats().print();
+        const cpupg::CsrGraph csr(cagraG); // 搜索时不再检查 -1 空位
+        for (uint64_t L : {16, 32, 64, 128})
+        {
+            SearchStats stats = search(csr, base, queries, dim, truth, self, std::max(L, TOPK + 1));
+            std::cout << "L " << L << ": recall@" << TOPK << " " << stats.recall << ", hops " << stats.hops
+                      << ", distances " << stats.distances << ", latency " << stats.latency << " us" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <chrono>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cpupg/builder_cagra.hpp>
+#include <cpupg/parameters.hpp>
+
+// 建图后去掉 -1 空位，以 csr 格式保存
+static void saveCsr(const cpupg::Graph<> &cagraG, const std::string &path)
+{
+    cpupg::CsrGraph csr(cagraG);
+    uint64_t slots = (uint64_t)cagraG.N * cagraG.K;
+    std::cout << "Packed " << csr.ids.size() << " edges, dropped " << slots - csr.ids.size()
+              << " empty slots of " << slots << std::endl;
+    std::cout << "Saving cagra to " << path << std::endl;
+    csr.save(path.c_str());
+
+    // 读回保存的文件，每行应与去掉 -1 后的 cagraG 行相同
+    cpupg::CsrGraph loaded;
+    loaded.load(path.c_str());
+    uint64_t badRows = 0;
+    if (loaded.N == cagraG.N)
+    {
+#pragma omp parallel for reduction(+ : badRows) schedule(dynamic, 1024)
+        for (uint64_t i = 0; i < cagraG.N; i++)
+        {
+            std::vector<cpupg::node_t> row;
+            std::copy_if(cagraG.edges(i), cagraG.edges(i) + cagraG.K, std::back_inserter(row),
+                         [](cpupg::node_t id)
+                         { return id != cpupg::EMPTY_ID; });
+            badRows += !std::equal(row.begin(), row.end(), loaded.edges(i), loaded.edges(i) + loaded.degree(i));
+        }
+    }
+    if (loaded.N != cagraG.N || loaded.eps != cagraG.eps || badRows != 0)
+    {
+        std::cerr << "Error: reloaded csr differs from the built graph (N " << loaded.N << " vs " << cagraG.N
+                  << ", " << badRows << " differing rows)." << std::endl;
+        exit(1);
+    }
+    std::cout << "Reloaded csr matches the built graph" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <json_path>" << std::endl;
+        exit(-1);
+    }
+
+    cpupg::CagraConfig config = cpupg::loadCagraConfig(argv[1]);
+
+    cpupg::Graph knnG = cpupg::loadCagraKnng(config);
+    std::cout << "Loaded!" << std::endl;
+
+    cpupg::GraphInfo info = cpupg::makeGraphInfo(config, knnG);
+    info.print();
+
+    if (!config.r_init_sweep.empty() || !config.r_sweep.empty())
+    {
+        // 一次 reorder 得到每组 (R_INIT, R) 的图，分别保存到带后缀的 SAVE_PATH
+        auto start = std::chrono::high_resolution_clock::now();
+        cpupg::CagraBuilder builder(info);
+        builder.buildSweep(std::move(knnG), cpupg::rInitValues(config), cpupg::rValues(config),
+                           [&](uint64_t rInit, uint64_t r, const cpupg::Graph<> &cagraG)
+                           {
+            saveCsr(cagraG, cpupg::sweepSavePath(config, rInit, r)); });
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> diff = end - start;
+        std::cout << "Cost time: " << diff.count() << " s" << std::endl;
+        builder.stats().print();
+        return 0;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cpupg::CagraBuilder builder(info);
+    cpupg::Graph cagraG = builder.build(std::move(knnG));
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+    std::cout << "Cost time: " << diff.count() << " s" << std::endl;
+    builder.stats().print();
+
+// 检查是否有重复边
+#ifdef DEBUG
+    if (1)
+    {
+        size_t edges = 0;
+        size_t deDupEdges = 0;
+#pragma omp parallel for reduction(+ : edges, deDupEdges) schedule(dynamic, 100)
+        for (uint64_t i = 0; i < cagraG.N; i++)
+        {
+            std::unordered_set<cpupg::node_t> s;
+            for (uint64_t j = 0; j < cagraG.K; j++)
+            {
+                if (cagraG.at(i, j) != cpupg::EMPTY_ID)
+                {
+                    edges++;
+                    s.insert(cagraG.at(i, j));
+                }
+            }
+            deDupEdges += s.size();
+        }
+        float ratio = (float)deDupEdges / (float)edges;
+        std::cout << "Total edges: " << edges << " Deduplicate edges: " << deDupEdges << " ratio: " << ratio << std::endl;
+    }
+#endif
+    saveCsr(cagraG, config.save_path);
+    return 0;
+}
\ No newline at end of file
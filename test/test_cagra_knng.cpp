@@ -14,61 +14,63 @@ int main(int argc, char *argv[])
 
     cpupg::CagraConfig config = cpupg::loadCagraConfig(argv[1]);
 
-    cpupg::Graph knnG;
-    if (config.knng_format == "efanna")
-    {
-        std::cout << "Loading efanna knng from " << config.knng_path << std::endl;
-        knnG.loadKnng(config.knng_path.c_str());
-    }
-    else if (config.knng_format == "fbin")
-    {
-        std::cout << "Loading fbin knng from " << config.knng_path << std::endl;
-        knnG.loadKnngFbin(config.knng_path.c_str());
-    }
-    else
-    {
-        std::cerr << config.knng_format << " is not supported!" << std::endl;
-        exit(-1);
-    }
+    cpupg::Graph knnG = cpupg::loadCagraKnng(config);
     std::cout << "Loaded!" << std::endl;
 
-    cpupg::GraphInfo info;
-
-    info.N = knnG.N;
-    info.R_KNNG = knnG.K;
-    info.R_INIT = config.r_init;
-    info.R = config.r;
+    cpupg::GraphInfo info = cpupg::makeGraphInfo(config, knnG);
     info.print();
 
+    if (!config.r_init_sweep.empty() || !config.r_sweep.empty())
+    {
+        // 一次 reorder 得到每组 (R_INIT, R) 的图，分别保存到带后缀的 SAVE_PATH
+        auto start = std::chrono::high_resolution_clock::now();
+        cpupg::CagraBuilder builder(info);
+        builder.buildSweep(std::move(knnG), cpupg::rInitValues(config), cpupg::rValues(config),
+                           [&](uint64_t rInit, uint64_t r, const cpupg::Graph<> &cagraG)
+                           {
+            std::string path = cpupg::sweepSavePath(config, rInit, r);
+            std::cout << "Saving cagra to " << path << std::endl;
+            cagraG.saveKnng(path.c_str()); });
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> diff = end - start;
+        std::cout << "Cost time: " << diff.count() << " s" << std::endl;
+        builder.stats().print();
+        return 0;
+    }
+
     auto start = std::chrono::high_resolution_clock::now();
     cpupg::CagraBuilder builder(info);
-    cpupg::Graph cagraG = builder.build(knnG); // knnG will be destroyed!
+    cpupg::Graph cagraG = builder.build(std::move(knnG));
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> diff = end - start;
     std::cout << "Cost time: " << diff.count() << " s" << std::endl;
+    builder.stats().print();
 
-// 检查是否有重复边
+// 检查是否有重复边、自环和空位，merge 去重补齐后三者都应为 0（候选不足时才会有空位）
 #ifdef DEBUG
     if (1)
     {
         size_t edges = 0;
         size_t deDupEdges = 0;
-#pragma omp parallel for reduction(+ : edges, deDupEdges) schedule(dynamic, 100)
-        for (int32_t i = 0; i < cagraG.N; i++)
+        size_t selfLoops = 0;
+#pragma omp parallel for reduction(+ : edges, deDupEdges, selfLoops) schedule(dynamic, 100)
+        for (uint64_t i = 0; i < cagraG.N; i++)
         {
-            std::unordered_set<int> s;
+            std::unordered_set<cpupg::node_t> s;
             for (uint64_t j = 0; j < cagraG.K; j++)
             {
-                if (cagraG.at(i, j) != -1)
+                if (cagraG.at(i, j) != cpupg::EMPTY_ID)
                 {
                     edges++;
                     s.insert(cagraG.at(i, j));
+                    selfLoops += cagraG.at(i, j) == i;
                 }
             }
             deDupEdges += s.size();
         }
         float ratio = (float)deDupEdges / (float)edges;
         std::cout << "Total edges: " << edges << " Deduplicate edges: " << deDupEdges << " ratio: " << ratio << std::endl;
+        std::cout << "Self loops: " << selfLoops << " Empty slots: " << cagraG.N * cagraG.K - edges << std::endl;
     }
 #endif
     std::cout << "Saving cagra to " << config.save_path << std::endl;
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cpupg/builder_cagra.hpp>
+
+// 合成的环形 KNNG：节点 x 的第 2i、2i + 1 个邻居为 x + (i + 1)、x - (i + 1)（模 N）。
+// 默认节点数超过 2^31，用来检查 id 不小于 2^31 的节点和 64 位下标在整个建图流程中
+// 都是正确的；建图后每行前两个邻居应为 x + 1、x - 1。默认度数取得很小，仍留有边供 reorder 剪枝，
+// 内存约为每节点 28 字节。注意：默认规模（约 58 GB）尚未实际跑过，只在 2^25 个节点以内验证过
+static cpupg::node_t ringNeighbor(uint64_t id_x, uint64_t rank, uint64_t N)
+{
+    uint64_t offset = (rank / 2 + 1) % N;
+    return rank % 2 == 0 ? (id_x + offset) % N : (id_x + N - offset) % N;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " [num_nodes] [r_init] [r]" << std::endl;
+        exit(-1);
+    }
+    const uint64_t N = argc > 1 ? strtoull(argv[1], nullptr, 10) : (1ull << 31) + (1ull << 20);
+    const uint64_t R_INIT = argc > 2 ? strtoull(argv[2], nullptr, 10) : 4;
+    const uint64_t R = argc > 3 ? strtoull(argv[3], nullptr, 10) : 2;
+    if (N < 2 * R_INIT + 1 || N > cpupg::EMPTY_ID || R < 2 || R > R_INIT)
+    {
+        std::cerr << "Error: need 2 * r_init < num_nodes < 2^32 and 2 <= r <= r_init." << std::endl;
+        exit(-1);
+    }
+
+    std::cout << "Generating ring knng with " << N << " nodes" << std::endl;
+    cpupg::Graph<> knnG;
+    knnG.allocate(N, R_INIT);
+#pragma omp parallel for schedule(static)
+    for (uint64_t id_x = 0; id_x < N; id_x++)
+    {
+        for (uint64_t i = 0; i < R_INIT; i++)
+        {
+            knnG.at(id_x, i) = ringNeighbor(id_x, i, N);
+        }
+    }
+
+    cpupg::GraphInfo info;
+    info.N = N;
+    info.R_KNNG = R_INIT;
+    info.R_INIT = R_INIT;
+    info.R = R;
+    info.print();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cpupg::CagraBuilder builder(info);
+    cpupg::Graph<> cagraG = builder.build(std::move(knnG));
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+    std::cout << "Cost time: " << diff.count() << " s" << std::endl;
+    builder.stats().print();
+
+    // 检查每行：id 在范围内、无自环、无重复，前两个邻居为环上的两侧
+    uint64_t badRows = 0;
+    uint64_t highEdges = 0; // 指向 id 不小于 2^31 的节点的边数
+#pragma omp parallel for reduction(+ : badRows, highEdges) schedule(dynamic, 1024)
+    for (uint64_t id_x = 0; id_x < N; id_x++)
+    {
+        const cpupg::node_t *row = cagraG.edges(id_x);
+        bool ok = row[0] == ringNeighbor(id_x, 0, N) && row[1] == ringNeighbor(id_x, 1, N);
+        for (uint64_t j = 0; j < cagraG.K && ok; j++)
+        {
+            ok = row[j] != cpupg::EMPTY_ID && row[j] < N && row[j] != id_x &&
+                 std::find(row, row + j, row[j]) == row + j;
+            highEdges += row[j] >= (1ull << 31);
+        }
+        badRows += !ok;
+    }
+    std::cout << "Edges to nodes with id >= 2^31: " << highEdges << ", bad rows: " << badRows << std::endl;
+    if (highEdges == 0)
+    {
+        std::cout << "Note: no id >= 2^31 was exercised, pass more than 2^31 nodes to cover them" << std::endl;
+    }
+    if (badRows != 0)
+    {
+        std::cerr << "Error: " << badRows << " rows are wrong." << std::endl;
+        exit(1);
+    }
+    std::cout << "OK" << std::endl;
+    return 0;
+}